@@ -0,0 +1,247 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/client_id_generator.hpp"
+#include "../include/mac_address.hpp"
+#include "../include/network_updater.hpp"
+#include "../include/parsed_url.hpp"
+#include "../include/payload_buffer.hpp"
+#include "../include/request_template.hpp"
+#include "../include/update_dispatcher.hpp"
+#include "../test/allocation_counter.hpp"
+#include "../test/http_test_server.hpp"
+
+namespace {
+
+constexpr int kServerPort = 8090;
+constexpr char kUri[] = "http://localhost";
+constexpr char kSmallConfig[] = "bench_config_small.json";
+constexpr char kLargeConfig[] = "bench_config_large.json";
+constexpr char kDefaultOutput[] = "bench_updater.json";
+
+// removed when the run is over, the biggest hosts file is ~300MB
+std::vector<std::string> created_files = {kSmallConfig, kLargeConfig};
+
+// The hosts files are written once per size and shared by the benchmarks
+std::string HostsFile(size_t rows) {
+    std::string fname = "bench_hosts_" + std::to_string(rows) + ".csv";
+    std::ifstream existing(fname);
+    if (existing.is_open()) {
+        return fname;
+    }
+
+    created_files.push_back(fname);
+    std::ofstream hosts(fname);
+    hosts << "\"mac_addresses, id1, id2, id3\"\n";
+    char mac[MacAddress::kTextLength + 1] = {};
+    for (size_t i = 0; i < rows; i++) {
+        // "aa" is answered with a 200 by the test server
+        MacAddress(0xaa0000000000ULL | i).Format(mac);
+        hosts << '"' << mac << ", 1, 2, 3\"\n";
+    }
+    return fname;
+}
+
+void WriteConfig(const char* fname, size_t applications) {
+    std::ofstream config(fname);
+    config << "{\"profile\": {\"applications\": [";
+    for (size_t i = 0; i < applications; i++) {
+        config << (i == 0 ? "" : ",") << "{\"id\": \"app_" << i
+               << "\", \"version\": \"v1.2." << i << "\"}";
+    }
+    config << "]}}";
+}
+
+void StartServer() {
+    static bool started = false;
+    if (started) {
+        return;
+    }
+    started = true;
+
+    std::thread([]() {
+        try {
+            HttpTestServer htpp_server("0.0.0.0", kServerPort,
+                                       std::thread::hardware_concurrency());
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }).detach();
+
+    // the first benchmark must not race the server to its listen()
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kServerPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int attempt = 0; attempt < 200; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int connected = connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                                sizeof(addr));
+        close(fd);
+        if (connected == 0) {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+}  // namespace
+
+// ReadMacAddrList through the constructor, which validates, normalizes and
+// deduplicates every row
+static void BM_ReadMacAddrList(benchmark::State& state) {
+    std::string hosts = HostsFile(state.range(0));
+    WriteConfig(kSmallConfig, 2);
+    for (auto _ : state) {
+        NetworkUpdater updater(hosts.c_str(), kSmallConfig, kUri,
+                               kServerPort);
+        benchmark::DoNotOptimize(updater.GetMacList().size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReadMacAddrList)
+    ->Arg(1000)
+    ->Arg(1000000)
+    ->Arg(10000000)
+    ->Unit(benchmark::kMillisecond);
+
+// ReadJsonConfig maps the payload once, the arg is its application count.
+// The pages are only read by curl, so the size should barely matter.
+static void BM_ReadJsonConfig(benchmark::State& state) {
+    const char* fname = state.range(0) > 10 ? kLargeConfig : kSmallConfig;
+    WriteConfig(fname, state.range(0));
+    for (auto _ : state) {
+        PayloadBuffer payload;
+        benchmark::DoNotOptimize(payload.Load(fname));
+    }
+}
+BENCHMARK(BM_ReadJsonConfig)->Arg(2)->Arg(100000);
+
+// range(0) selects unique ids, called from several threads at once
+static void BM_GenerateHttpId(benchmark::State& state) {
+    static ClientIdGenerator client_ids(NetworkUpdater::kMaxClientId);
+    if (state.thread_index() == 0) {
+        client_ids.SetUnique(state.range(0) != 0);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(client_ids.Next());
+    }
+}
+BENCHMARK(BM_GenerateHttpId)->Arg(0)->Arg(1)->ThreadRange(1, 4);
+
+// ParsedUrl::Parse replaced the IsUrlValid regex
+static void BM_IsUrlValid(benchmark::State& state) {
+    const std::string uri = "https://fleet.example-1.com:8443/api";
+    ParsedUrl url;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ParsedUrl::Parse(uri, &url));
+    }
+}
+BENCHMARK(BM_IsUrlValid);
+
+// What SendRequest does before the transfer: parse the mac and patch it
+// into the url of the host, without touching the heap
+static void BM_BuildRequest(benchmark::State& state) {
+    RequestTemplate request("http://localhost:8080/profiles/clientId:");
+    ClientIdGenerator client_ids(NetworkUpdater::kMaxClientId);
+    std::string url;
+    std::string client_id;
+    request.InitUrl(&url);
+    request.InitClientIdHeader(&client_id);
+    MacAddress mac;
+    AllocationCounter::Start();
+    for (auto _ : state) {
+        MacAddress::Parse("b2:22:cc:dd:ee:ff", &mac);
+        request.PatchUrl(mac, &url);
+        request.PatchClientIdHeader(client_ids.Next(), &client_id);
+        benchmark::DoNotOptimize(url.data());
+        benchmark::DoNotOptimize(client_id.data());
+    }
+    AllocationCounter::Stop();
+    state.counters["allocs_per_host"] = benchmark::Counter(
+        AllocationCounter::GetCount(), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_BuildRequest);
+
+// Every host of the list updated against the in process test server,
+// range(0) is the dispatcher mode and range(1) its concurrency. The event
+// loop and a single worker send from the benchmark thread, their heap
+// allocations are counted.
+static void BM_Dispatch(benchmark::State& state) {
+    constexpr size_t kHosts = 1000;
+    StartServer();
+    WriteConfig(kSmallConfig, 2);
+    std::string hosts = HostsFile(kHosts);
+    NetworkUpdater updater(hosts.c_str(), kSmallConfig, kUri, kServerPort);
+    std::ostringstream log;
+    UpdateDispatcher dispatcher(
+        &updater, &log, state.range(1), false,
+        static_cast<UpdateDispatcher::Mode>(state.range(0)));
+    bool counted = state.range(0) == UpdateDispatcher::Mode::EventLoop ||
+                   state.range(1) == 1;
+    if (counted) {
+        AllocationCounter::Start();
+    }
+    for (auto _ : state) {
+        if (dispatcher.Run() != NetworkUpdater::UpdaterErr::Ok) {
+            state.SkipWithError("Dispatch failed");
+            break;
+        }
+        log.str("");
+    }
+    AllocationCounter::Stop();
+    state.SetItemsProcessed(state.iterations() * kHosts);
+    if (counted) {
+        state.counters["allocs_per_host"] = benchmark::Counter(
+            static_cast<double>(AllocationCounter::GetCount()) / kHosts,
+            benchmark::Counter::kAvgIterations);
+    }
+}
+BENCHMARK(BM_Dispatch)
+    ->ArgsProduct({{UpdateDispatcher::Mode::Threads,
+                    UpdateDispatcher::Mode::EventLoop},
+                   {1, 8}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Same as BENCHMARK_MAIN, but the results are also written as json to
+// bench_updater.json unless --benchmark_out says otherwise, so two builds
+// can be compared with tools/compare.py
+int main(int argc, char** argv) {
+    std::vector<char*> args(argv, argv + argc);
+    std::string out = std::string("--benchmark_out=") + kDefaultOutput;
+    std::string format = "--benchmark_out_format=json";
+    bool has_out = false;
+    for (int i = 1; i < argc; i++) {
+        has_out |= std::string(argv[i]).rfind("--benchmark_out=", 0) == 0;
+    }
+    if (!has_out) {
+        args.push_back(&out[0]);
+        args.push_back(&format[0]);
+    }
+
+    int args_count = static_cast<int>(args.size());
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    for (const auto& fname : created_files) {
+        remove(fname.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef CIRCUIT_BREAKER_HPP_
+#define CIRCUIT_BREAKER_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Stops sending to the profile server once it is failing. The breaker trips
+// open when the share of 5xx replies and transfers without a reply among the
+// last requests reaches the failure ratio; while open every request fails at
+// once without going out. When the open time is over a single probe request
+// is let through (half open): a reply closes the breaker again, a failure
+// opens it for twice as long as before.
+class CircuitBreaker {
+ public:
+    enum class State { Closed, Open, HalfOpen };
+    using Clock = std::chrono::steady_clock;
+
+    // outcomes the failure ratio is measured over
+    static constexpr size_t kWindowSize = 100;
+    // the breaker never trips on fewer outcomes
+    static constexpr size_t kMinRequests = 20;
+    static constexpr double kDefaultFailureRatio = 0.5;
+    static constexpr std::chrono::milliseconds kDefaultOpenTime{1000};
+    static constexpr std::chrono::milliseconds kMaxOpenTime{30000};
+
+    CircuitBreaker() = default;
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    // A failure_ratio of 0 disables the breaker, open_time is the first
+    // open period
+    void Configure(double failure_ratio, std::chrono::milliseconds open_time);
+
+    // Returns false when the request has to fail without being sent. probe
+    // is set when the request is the one half open probe, its outcome
+    // alone decides whether the breaker closes.
+    bool Allow(bool* probe);
+    void Record(bool failed, bool probe);
+
+    State GetState() const;
+    uint64_t GetTripCount() const;
+    uint64_t GetRejectedCount() const;
+    // Status codes the breaker counts as failures: 5xx and 0, no reply
+    static bool IsFailure(long status_code);
+
+ private:
+    void Trip(Clock::time_point now);
+    void ResetWindow();
+
+    mutable std::mutex mutex_;
+    // read without the lock on the way of every request
+    std::atomic<State> state_{State::Closed};
+    std::atomic<bool> enabled_{true};
+    double failure_ratio_{kDefaultFailureRatio};
+    std::chrono::milliseconds min_open_time_{kDefaultOpenTime};
+    std::chrono::milliseconds open_time_{kDefaultOpenTime};
+    Clock::time_point open_until_;
+    bool probing_{false};
+    // ring of the last outcomes, true for a failure
+    std::array<bool, kWindowSize> window_{};
+    size_t next_outcome_{0};
+    size_t outcomes_{0};
+    size_t failures_{0};
+    uint64_t trips_{0};
+    std::atomic<uint64_t> rejected_{0};
+};
+
+#endif  // CIRCUIT_BREAKER_HPP_
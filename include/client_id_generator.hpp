@@ -0,0 +1,28 @@
+#ifndef CLIENT_ID_GENERATOR_HPP_
+#define CLIENT_ID_GENERATOR_HPP_
+
+#include <atomic>
+#include <cstdint>
+
+// Hands out the x-client-id of every request. By default the ids are random
+// in 1..max_id, drawn from a splitmix64 generator each thread seeds once, so
+// no call takes a lock or a syscall. Random ids collide after a few hundred
+// hosts, in unique mode they are taken from a shared counter instead and
+// only go past max_id once a run has more than max_id hosts.
+class ClientIdGenerator {
+ public:
+    explicit ClientIdGenerator(uint32_t max_id);
+
+    void SetUnique(bool unique);
+    bool IsUnique() const;
+
+    // Safe to call from any number of threads
+    uint32_t Next();
+
+ private:
+    uint32_t max_id_;
+    bool unique_{false};
+    std::atomic<uint32_t> next_id_{1};
+};
+
+#endif  // CLIENT_ID_GENERATOR_HPP_
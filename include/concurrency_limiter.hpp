@@ -0,0 +1,65 @@
+#ifndef CONCURRENCY_LIMITER_HPP_
+#define CONCURRENCY_LIMITER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Finds how many requests the server takes in parallel instead of relying on
+// a fixed concurrency. The requests are judged in windows of at least
+// kMinWindowSamples replies (or one limit worth of them): a window with more
+// than kDropTolerance of its requests dropped, or whose p99 went past
+// kLatencyTolerance times the baseline p99, cuts the limit by kBackoffRatio.
+// A clean window that used the whole limit raises it, doubling it until the
+// first cut (like TCP slow start) and by one afterwards (AIMD). The baseline
+// is a slow moving average of the window p99s, so a server that got slower
+// for good stops looking overloaded after a while.
+class ConcurrencyLimiter {
+ public:
+    static constexpr uint32_t kDefaultInitialLimit = 4;
+    // enough for the p99 not to be the slowest reply of the window
+    static constexpr size_t kMinWindowSamples = 100;
+    static constexpr double kBackoffRatio = 0.9;
+    static constexpr double kLatencyTolerance = 2.0;
+    // the odd failure of a healthy server is no reason to slow down
+    static constexpr double kDropTolerance = 0.05;
+    // weight of a window p99 in the baseline
+    static constexpr double kBaselineWeight = 0.1;
+
+    ConcurrencyLimiter(uint32_t min_limit, uint32_t max_limit,
+                       uint32_t initial_limit);
+
+    // Blocks until one more request may be sent
+    void Acquire();
+    // Returns false instead of waiting, for the event loop
+    bool TryAcquire();
+    // Called once the request that was let through is over
+    void Release(std::chrono::microseconds latency, bool dropped);
+
+    uint32_t GetLimit() const;
+    uint32_t GetInFlight() const;
+    // A timeout or transport error (status 0) and any 5xx reply mean the
+    // server could not keep up
+    static bool IsDropped(uint32_t status_code);
+
+ private:
+    void CloseWindow();
+
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+    uint32_t min_limit_;
+    uint32_t max_limit_;
+    // fractional, a few clean windows after a cut add up to one more request
+    double limit_;
+    bool slow_start_{true};
+    uint32_t in_flight_{0};
+    uint32_t window_max_in_flight_{0};
+    uint32_t window_dropped_{0};
+    std::vector<uint64_t> window_latencies_;
+    // microseconds, 0 until the first window closed
+    double baseline_p99_{0};
+};
+
+#endif  // CONCURRENCY_LIMITER_HPP_
@@ -0,0 +1,72 @@
+#ifndef CONNECTION_POOL_HPP_
+#define CONNECTION_POOL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace cpr {
+class Session;
+}
+
+// Keeps finished cpr sessions (and the keep-alive connection held by their
+// curl handle) per destination so the next request to the same uri:port
+// skips the TCP/TLS handshake.
+class ConnectionPool {
+ public:
+    struct Stats {
+        uint64_t sessions_created;
+        uint64_t sessions_reused;
+        uint64_t sessions_evicted;
+        uint64_t connections_opened;
+        uint64_t connections_reused;
+    };
+
+    static constexpr size_t kDefaultPoolSize = 8;
+    static constexpr std::chrono::seconds kDefaultIdleTimeout{30};
+
+    ConnectionPool(size_t pool_size, std::chrono::seconds idle_timeout);
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    void Configure(size_t pool_size, std::chrono::seconds idle_timeout);
+    size_t GetPoolSize() const;
+    std::chrono::seconds GetIdleTimeout() const;
+
+    // Returns an idle session for the destination or a fresh one, in which
+    // case created is set
+    std::unique_ptr<cpr::Session> Acquire(const std::string& destination,
+                                          bool* created);
+    // Hands the session back, it is dropped if the pool is already full
+    void Release(const std::string& destination,
+                 std::unique_ptr<cpr::Session> session);
+    // Called after every transfer, reused is true when curl did not have to
+    // open a new connection for it
+    void CountConnection(bool reused);
+    Stats GetStats() const;
+
+ private:
+    struct IdleSession {
+        std::unique_ptr<cpr::Session> session;
+        std::chrono::steady_clock::time_point released_at;
+    };
+
+    mutable std::mutex mutex_;
+    size_t pool_size_;
+    std::chrono::seconds idle_timeout_;
+    std::map<std::string, std::deque<IdleSession>> idle_sessions_;
+
+    std::atomic<uint64_t> sessions_created_{0};
+    std::atomic<uint64_t> sessions_reused_{0};
+    std::atomic<uint64_t> sessions_evicted_{0};
+    std::atomic<uint64_t> connections_opened_{0};
+    std::atomic<uint64_t> connections_reused_{0};
+};
+
+#endif  // CONNECTION_POOL_HPP_
@@ -0,0 +1,42 @@
+#ifndef LATENCY_HISTOGRAM_HPP_
+#define LATENCY_HISTOGRAM_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Log linear histogram of microsecond durations, laid out like HdrHistogram:
+// values under 2^kSubBucketBits are counted exactly, every power of two above
+// is split in 2^kSubBucketBits buckets, so a percentile is never more than
+// 1% away from the recorded value. Record is a relaxed atomic increment, any
+// number of threads may record while another one reads.
+class LatencyHistogram {
+ public:
+    static constexpr uint32_t kSubBucketBits = 7;
+    // ~9.5 hours, longer values are counted as the largest one
+    static constexpr uint32_t kMaxValueBits = 35;
+
+    void Record(uint64_t value);
+    uint64_t GetCount() const;
+    uint64_t GetMax() const;
+    double GetMean() const;
+    // Highest value the given share of the recorded values stays under,
+    // percentile is in 0..100
+    uint64_t GetPercentile(double percentile) const;
+
+ private:
+    static constexpr size_t kSubBucketCount = size_t{1} << kSubBucketBits;
+    static constexpr size_t kBucketCount =
+        (kMaxValueBits - kSubBucketBits + 1) * kSubBucketCount;
+
+    static size_t BucketOf(uint64_t value);
+    static uint64_t HighestValueOf(size_t bucket);
+
+    std::array<std::atomic<uint64_t>, kBucketCount> counts_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+#endif  // LATENCY_HISTOGRAM_HPP_
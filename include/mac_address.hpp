@@ -0,0 +1,81 @@
+#ifndef MAC_ADDRESS_HPP_
+#define MAC_ADDRESS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A mac address packed in the low 48 bits of an integer. It is turned back
+// into its "aa:bb:cc:dd:ee:ff" text only when a request url is built.
+class MacAddress {
+ public:
+    static constexpr size_t kTextLength = 17;
+
+    constexpr MacAddress() = default;
+    explicit constexpr MacAddress(uint64_t value)
+        : value_(value & 0xffffffffffffULL) {}
+
+    // Validates and normalizes the text form: six hex octets, digits in any
+    // case, separated by ':' or '-' (the same one throughout). Uses SSE2 when
+    // the target has it, ParseScalar otherwise.
+    static bool Parse(std::string_view text, MacAddress* mac);
+    static bool ParseScalar(std::string_view text, MacAddress* mac);
+
+    constexpr uint64_t value() const { return value_; }
+    // Writes the kTextLength lowercase characters, no terminator
+    void Format(char* out) const;
+    std::string ToString() const;
+
+    constexpr bool operator==(const MacAddress& other) const {
+        return value_ == other.value_;
+    }
+    constexpr bool operator!=(const MacAddress& other) const {
+        return value_ != other.value_;
+    }
+    constexpr bool operator<(const MacAddress& other) const {
+        return value_ < other.value_;
+    }
+
+ private:
+    uint64_t value_{0};
+};
+
+// The hosts of a run, 8 bytes per entry instead of a std::string each, plus
+// 4 for the group of the host when the hosts are grouped
+class MacList {
+ public:
+    using const_iterator = std::vector<MacAddress>::const_iterator;
+
+    void push_back(MacAddress mac) { macs_.push_back(mac); }
+    void push_back(MacAddress mac, uint32_t group) {
+        groups_.resize(macs_.size());
+        macs_.push_back(mac);
+        groups_.push_back(group);
+    }
+    void reserve(size_t count) { macs_.reserve(count); }
+    // 0 for the hosts added without a group
+    uint32_t group(size_t index) const {
+        return index < groups_.size() ? groups_[index] : 0;
+    }
+    size_t size() const { return macs_.size(); }
+    bool empty() const { return macs_.empty(); }
+    const MacAddress& operator[](size_t index) const { return macs_[index]; }
+    const_iterator begin() const { return macs_.begin(); }
+    const_iterator end() const { return macs_.end(); }
+
+    // Keeps the first occurrence of every mac, in order, and returns the
+    // number of entries removed
+    size_t RemoveDuplicates();
+
+    // Text form of the list, a 17 character string per host, so only ever
+    // asked for explicitly
+    std::vector<std::string> ToStrings() const;
+
+ private:
+    std::vector<MacAddress> macs_;
+    std::vector<uint32_t> groups_;
+};
+
+#endif  // MAC_ADDRESS_HPP_
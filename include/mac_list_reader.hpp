@@ -0,0 +1,43 @@
+#ifndef MAC_LIST_READER_HPP_
+#define MAC_LIST_READER_HPP_
+
+#include <cstddef>
+#include <string_view>
+
+#include "payload_buffer.hpp"
+
+// Walks the hosts file in place: the file is memory mapped and every call to
+// Next finds the following line and its first column with memchr, without
+// copying the line. Used to load the whole list up front or, in streaming
+// mode, to feed the dispatcher while the rest of the file is still unread.
+class MacListReader {
+ public:
+    MacListReader() = default;
+    ~MacListReader() = default;
+    MacListReader(const MacListReader&) = delete;
+    MacListReader& operator=(const MacListReader&) = delete;
+
+    // Returns false if the hosts file can not be opened
+    bool Open(const char* hosts_fname);
+
+    // Gives the mac column of the next host line, the header (a first line
+    // whose first column starts with "mac") and empty entries are skipped.
+    // The view stays valid as long as the reader is open.
+    bool Next(std::string_view* mac_addr);
+
+    // Column of the line the last mac was read from, 0 being the mac itself.
+    // Empty when the line has fewer columns.
+    std::string_view GetColumn(size_t column) const;
+
+    void Rewind();
+    // 1 based number of the line the last mac was read from
+    size_t GetLineNumber() const;
+
+ private:
+    PayloadBuffer file_;
+    size_t offset_{0};
+    size_t line_number_{0};
+    std::string_view line_;
+};
+
+#endif  // MAC_LIST_READER_HPP_
@@ -0,0 +1,37 @@
+#ifndef MAC_SET_HPP_
+#define MAC_SET_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mac_address.hpp"
+
+// Open addressing hash set over packed mac addresses, used to drop the hosts
+// that appear more than once in a hosts file. A slot stores the 48 bit value
+// plus one, so zero marks an empty slot and 00:00:00:00:00:00 still fits.
+class MacSet {
+ public:
+    MacSet() = default;
+    explicit MacSet(size_t expected_count);
+
+    // Sizes the table so expected_count entries stay under 3/4 load
+    void reserve(size_t expected_count);
+    // Returns false if the mac was already in the set
+    bool insert(const MacAddress& mac);
+    bool contains(const MacAddress& mac) const;
+    // Hints the cache about the slot of a mac that is inserted soon after
+    void prefetch(const MacAddress& mac) const;
+    size_t size() const { return size_; }
+    void clear();
+
+ private:
+    size_t SlotOf(uint64_t key) const;
+    void Grow();
+
+    std::vector<uint64_t> slots_;
+    size_t mask_{0};
+    size_t size_{0};
+};
+
+#endif  // MAC_SET_HPP_
@@ -0,0 +1,104 @@
+#ifndef MULTI_TRANSPORT_HPP_
+#define MULTI_TRANSPORT_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.hpp"
+#include "mac_address.hpp"
+#include "network_updater.hpp"
+
+// Event driven transport built on the curl multi interface. A single thread
+// keeps up to max_in_flight PUT requests running and reuses the easy handles
+// (and their connections) of the finished ones for the next hosts. With
+// hedging, a request still running past the p95 of the ones before it gets a
+// duplicate with the same x-client-id, so the server can tell it from a
+// second update; the first reply wins and the other transfer is dropped. The
+// duplicates only run on a few spare slots, never on the ones the hosts get.
+// A job refused with a 401, or left with an expired token, waits by the
+// generation of its token while the background refresh fetches the next one,
+// the other transfers go on.
+class MultiTransport {
+ public:
+    struct Job {
+        MacAddress mac;
+        uint32_t group;
+        uint32_t attempt;
+        // set by the dispatcher when it hands the job out
+        std::chrono::steady_clock::time_point started_at;
+        // the job is the half open probe of the circuit breaker
+        bool probe;
+    };
+
+    // Fills the next job to send, returns false when there is nothing to send
+    // right now. Called from the event loop thread only.
+    using NextJob = std::function<bool(Job* job)>;
+    using JobDone = std::function<void(const Job& job,
+                                       NetworkUpdater::UpdaterErr status,
+                                       uint32_t status_code)>;
+
+    MultiTransport(NetworkUpdater* updater, uint32_t max_in_flight);
+    ~MultiTransport();
+    MultiTransport(const MultiTransport&) = delete;
+    MultiTransport& operator=(const MultiTransport&) = delete;
+
+    // Drives the event loop until next_job runs dry and every transfer ended
+    void Run(const NextJob& next_job, const JobDone& job_done);
+    // Makes Run ask next_job again by then even if no transfer ends, for a
+    // next_job that holds a job back. Called from next_job.
+    void WakeAt(std::chrono::steady_clock::time_point when);
+    void SetHedging(bool enabled);
+
+    // replies needed before the p95 is trusted to hedge on
+    static constexpr uint64_t kMinHedgeSamples = 20;
+    static constexpr double kHedgePercentile = 95;
+    // one spare slot for every this many slots, at least one
+    static constexpr size_t kSlotsPerSpare = 10;
+    // how often the jobs waiting for a token look for a new one
+    static constexpr std::chrono::milliseconds kTokenPollInterval{10};
+
+ private:
+    struct Slot;
+    // A job waiting for the token to be replaced, slot is the one it holds
+    // until it can be sent, nullptr once it was refused with a 401
+    struct Parked {
+        Job job;
+        Slot* slot;
+    };
+
+    Slot* AddSlot();
+    void InitSlot(Slot* slot);
+    void FreeSlot(Slot* slot);
+    // A hedge reuses the client id of the transfer it duplicates
+    void StartTransfer(Slot* slot, const Slot* hedged = nullptr);
+    void FinishTransfer(Slot* slot, int curl_code, const JobDone& job_done);
+    // Sends the parked jobs whose token was replaced and hands the 401 ones
+    // back as retries, or as failures if the token could not be replaced
+    void ResumeParked(const JobDone& job_done);
+    // Duplicates the transfers past the hedge delay while spare slots are
+    // free
+    void StartHedges();
+
+    NetworkUpdater* updater_;
+    void* multi_;
+    long idle_timeout_;
+    long http_version_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::vector<Slot*> free_slots_;
+    // only ever used for hedges
+    std::vector<Slot*> spare_slots_;
+    std::chrono::steady_clock::time_point wake_at_;
+    bool hedging_{false};
+    // by the generation of the token they wait to see replaced
+    std::multimap<uint64_t, Parked> parked_;
+    // microseconds from the start of a transfer to its reply, or to its
+    // failure capped at the request timeout
+    LatencyHistogram latencies_;
+};
+
+#endif  // MULTI_TRANSPORT_HPP_
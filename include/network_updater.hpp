@@ -1,15 +1,27 @@
 #ifndef NETWORK_UPDATER_HPP_
 #define NETWORK_UPDATER_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#ifdef VALID_TOKEN_SCENARIO
-#undef VALID_TOKEN_SCENARIO
-#endif
-
-// define it here in order to use the token functionality
-// #define VALID_TOKEN_SCENARIO 1
+#include "circuit_breaker.hpp"
+#include "client_id_generator.hpp"
+#include "connection_pool.hpp"
+#include "mac_address.hpp"
+#include "mac_list_reader.hpp"
+#include "parsed_url.hpp"
+#include "payload_buffer.hpp"
+#include "request_stats.hpp"
+#include "request_template.hpp"
+#include "token_cache.hpp"
+#include "token_manager.hpp"
 
 class NetworkUpdater {
  public:
@@ -24,28 +36,164 @@ class NetworkUpdater {
 
     };
 
+    // A hosts file row that is not a valid mac address
+    struct RejectedHost {
+        size_t line_number;
+        std::string text;
+    };
+
+    // The buffers a worker builds its updates in. They are sized by its
+    // first update and then only patched, so an update does not touch the
+    // heap until the token changes.
+    struct RequestBuffers {
+        RequestBuffers();
+        ~RequestBuffers();
+
+        std::string url;
+        std::string client_id_header;
+        std::string token_header;
+        uint64_t token_generation{0};
+        // the curl header list, its nodes point into the buffers above
+        struct HeaderList;
+        std::unique_ptr<HeaderList> headers;
+    };
+
+    // With stream_hosts the hosts file is not loaded up front, the macs are
+    // read through GetMacReader while the updates are dispatched. A
+    // group_column other than 0 groups the hosts by that column of the hosts
+    // file, 1 to 3 being id1 to id3.
     NetworkUpdater(const char* hosts_fname, const char* json_fname,
-                   const char* uri, int port);
+                   const char* uri, int port, bool stream_hosts = false,
+                   size_t group_column = 0);
     ~NetworkUpdater() = default;
     NetworkUpdater::UpdaterErr SendRequest(const std::string& mac_addr,
                                            uint32_t* status_code);
-    std::vector<std::string> const& GetMacList() const;
+    NetworkUpdater::UpdaterErr SendRequest(const MacAddress& mac,
+                                           uint32_t* status_code);
+    // For a worker sending one update after the other, buffers is kept
+    // between its calls
+    NetworkUpdater::UpdaterErr SendRequest(const MacAddress& mac,
+                                           RequestBuffers* buffers,
+                                           uint32_t* status_code);
+    MacList const& GetMacList() const;
+    // nullptr unless the updater streams the hosts file
+    MacListReader* GetMacReader();
+    // Rows dropped while loading or streaming the hosts file
+    void RejectHost(size_t line_number, std::string_view text);
+    std::vector<RejectedHost> GetRejectedHosts() const;
+    // Hosts listed more than once, only their first row is updated
+    void CountDuplicateHost();
+    size_t GetDuplicateCount() const;
+    // 0 when the hosts are not grouped
+    size_t GetGroupColumn() const;
+    // Index of a group by its name, a new name gets the next one
+    uint32_t GetHostGroup(std::string_view name);
+    std::string GetGroupName(uint32_t group) const;
+    size_t GetGroupCount() const;
+    void SetConnectionPool(size_t pool_size, std::chrono::seconds idle_timeout);
+    ConnectionPool& GetConnectionPool();
+    // Sends the updates as HTTP/2 streams, h2c prior knowledge for http://
+    // destinations and ALPN negotiated h2 for https:// ones. Fails when the
+    // linked libcurl lacks HTTP/2 or predates kMinHttp2CurlVersion.
+    NetworkUpdater::UpdaterErr SetHttp2(bool enabled,
+                                        uint32_t max_streams_per_connection);
+    // Never hand out the same client id twice in a run
+    void SetUniqueClientIds(bool unique);
+    bool HasUniqueClientIds() const;
+    bool IsHttp2() const;
+    bool IsHttps() const;
+    uint32_t GetMaxStreamsPerConnection() const;
+    // Time allowed to open a connection and to complete a whole update, 0
+    // for no limit. A timed out update ends without a reply.
+    void SetTimeouts(std::chrono::milliseconds connect_timeout,
+                     std::chrono::milliseconds request_timeout);
+    std::chrono::milliseconds GetConnectTimeout() const;
+    std::chrono::milliseconds GetRequestTimeout() const;
+    // Timings of every update sent so far, by status code
+    RequestStats& GetRequestStats();
+    // Guards the profile server, the dispatcher asks it before pacing an
+    // update and tells it how the update went
+    CircuitBreaker& GetCircuitBreaker();
+
+    // Pieces of a profile update, shared by the blocking SendRequest and the
+    // event driven MultiTransport
+    RequestTemplate const& GetRequestTemplate() const;
+    PayloadBuffer const& GetPayload() const;
+    uint32_t GenerateHttpId();
+    // Takes the bearer tokens from a token endpoint instead of the fixed
+    // test token and keeps them in cache_fname between runs. Call it before
+    // the first request.
+    NetworkUpdater::UpdaterErr SetTokenEndpoint(const std::string& token_url,
+                                                const std::string& cache_fname);
+    // Makes sure a token is there before the first request goes out
+    NetworkUpdater::UpdaterErr RequestToken();
+    std::string GetToken();
+    // The generation of a token lets a transport keep its serialized token
+    // header until the token really changes
+    TokenManager& GetTokenManager();
+    // token_generation is the generation of the token the request was sent
+    // with, a 401 replaces that token unless another request already did
+    NetworkUpdater::UpdaterErr HandleResponse(long status_code,
+                                              uint64_t token_generation);
 
     static uint32_t kTokenRetryCount;
+    static constexpr uint32_t kDefaultMaxStreams = 100;
+    // oldest libcurl that multiplexes streams on one connection, as 0xXXYYZZ
+    static constexpr uint32_t kMinHttp2CurlVersion = 0x080000;
+    static constexpr uint32_t kMaxClientId = 65535;
+    static constexpr std::chrono::milliseconds kDefaultConnectTimeout{5000};
+    static constexpr std::chrono::milliseconds kDefaultRequestTimeout{30000};
+    // sent when no token endpoint is configured
+    static constexpr char kTestToken[] = "123456789abcdef123456789abcdef";
+    static constexpr std::chrono::milliseconds kTokenTimeout{10000};
 
  private:
-    NetworkUpdater::UpdaterErr ReadMacAddrList(const char* hosts_fname);
+    NetworkUpdater::UpdaterErr ReadMacAddrList(const char* hosts_fname,
+                                               bool stream_hosts);
     NetworkUpdater::UpdaterErr ReadJsonConfig(const char* json_fname);
-    uint32_t GenerateHttpId();
-    void RequestToken();
-    bool IsUrlValid(const std::string& url);
+    void InitRequestBuffers(RequestBuffers* buffers);
+    // Sets what every update of a fresh pooled session shares
+    void InitSession(void* curl_handle);
+    NetworkUpdater::UpdaterErr PutProfile(RequestBuffers* buffers,
+                                          uint32_t* status_code);
+    bool FetchToken(std::string* token, std::chrono::seconds* expires_in);
 
-    static constexpr uint32_t kMaxClientId = 65535;
-    std::string json_config_;
-    std::vector<std::string> mac_list_;
-    std::string token_;
+    PayloadBuffer payload_;
+    MacList mac_list_;
+    std::unique_ptr<MacListReader> mac_reader_;
+    mutable std::mutex rejects_mutex_;
+    std::vector<RejectedHost> rejected_hosts_;
+    std::atomic<size_t> duplicate_hosts_{0};
+    size_t group_column_{0};
+    mutable std::mutex groups_mutex_;
+    std::map<std::string, uint32_t, std::less<>> group_ids_;
+    std::vector<std::string> group_names_;
+    // empty for the fixed test token
+    std::string token_url_;
+    std::unique_ptr<TokenCache> token_cache_;
+    // the cache is only good for the first token of a run
+    bool token_cache_read_{false};
+    // SendRequest may run on several dispatcher threads at once, declared
+    // after the members its refresher thread uses
+    TokenManager token_manager_{
+        [this](std::string* token, std::chrono::seconds* expires_in) {
+            return FetchToken(token, expires_in);
+        }};
     std::string uri_;
+    ParsedUrl url_;
     int port_;
+    // uri and port, the key of the pooled sessions
+    std::string destination_;
+    RequestTemplate request_template_;
+    bool http2_{false};
+    uint32_t max_streams_per_connection_{kDefaultMaxStreams};
+    std::chrono::milliseconds connect_timeout_{kDefaultConnectTimeout};
+    std::chrono::milliseconds request_timeout_{kDefaultRequestTimeout};
+    CircuitBreaker circuit_breaker_;
+    ConnectionPool connection_pool_{ConnectionPool::kDefaultPoolSize,
+                                    ConnectionPool::kDefaultIdleTimeout};
+    ClientIdGenerator client_ids_{kMaxClientId};
+    RequestStats request_stats_;
 };
 
 #endif  // NETWORK_UPDATER_HPP_
@@ -0,0 +1,29 @@
+#ifndef PARSED_URL_HPP_
+#define PARSED_URL_HPP_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// An http(s) url split in its parts by a single forward scan. The parts are
+// views into the parsed text, which has to outlive the ParsedUrl, so
+// validating a url never allocates.
+struct ParsedUrl {
+    std::string_view scheme;
+    std::string_view host;
+    // 0 when the url has no port
+    uint16_t port{0};
+    // empty or starting with '/'
+    std::string_view path;
+
+    // Accepts http:// or https://, a host made of lowercase letters, digits,
+    // '.' and '-', an optional port in 1..65535 and a path without spaces
+    static bool Parse(std::string_view text, ParsedUrl* url);
+
+    bool IsHttps() const { return scheme == "https"; }
+    // scheme://host:port followed by the path, default_port is used when the
+    // url has no port of its own and left out when it is 0 as well
+    std::string Join(uint16_t default_port) const;
+};
+
+#endif  // PARSED_URL_HPP_
@@ -0,0 +1,37 @@
+#ifndef PAYLOAD_BUFFER_HPP_
+#define PAYLOAD_BUFFER_HPP_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read only view of a memory mapped file. Holds the json config, so every
+// request of the run can hand the same bytes to curl by reference, and backs
+// the MacListReader. A file that can not be mapped, a pipe or /dev/stdin, is
+// read into memory instead.
+class PayloadBuffer {
+ public:
+    PayloadBuffer() = default;
+    ~PayloadBuffer();
+    PayloadBuffer(const PayloadBuffer&) = delete;
+    PayloadBuffer& operator=(const PayloadBuffer&) = delete;
+
+    // Returns false if the file can not be opened, mapped or read
+    bool Load(const char* fname);
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string_view view() const { return std::string_view(data_, size_); }
+
+ private:
+    bool ReadAll(int fd);
+    void Release();
+
+    const char* data_{""};
+    size_t size_{0};
+    void* mapping_{nullptr};
+    // the bytes of a file that was read rather than mapped
+    std::string copy_;
+};
+
+#endif  // PAYLOAD_BUFFER_HPP_
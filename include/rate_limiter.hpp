@@ -0,0 +1,61 @@
+#ifndef RATE_LIMITER_HPP_
+#define RATE_LIMITER_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "token_bucket.hpp"
+
+// Paces the updates to a global budget of the profile server and, when the
+// hosts are grouped (by site, subnet...), to a budget per group. A request
+// is booked in its group bucket first and in the global one only once its
+// group slot came, so the hosts of a throttled group never hold global slots
+// the other groups could use. The buckets of the groups are created the
+// first time one of their hosts is sent and then found without a lock, in
+// blocks of doubling size allocated as the group ids grow, so every group
+// has a bucket of its own. The ids are dense, the hosts file numbers the
+// groups in the order it names them.
+class RateLimiter {
+ public:
+    using Clock = TokenBucket::Clock;
+    // requests per second of a group, 0 for no limit
+    using GroupRate = std::function<double(uint32_t group)>;
+
+    // the first block holds 2^kFirstBlockBits groups, each next one twice
+    // as many as the one before
+    static constexpr uint32_t kFirstBlockBits = 6;
+    // enough blocks for every uint32_t group id
+    static constexpr uint32_t kBlockCount = 33 - kFirstBlockBits;
+    // a bucket holds this much of its rate after idling
+    static constexpr std::chrono::milliseconds kBurstWindow{10};
+
+    // global_rate 0 leaves the global budget unlimited, an empty group_rate
+    // the groups
+    RateLimiter(double global_rate, GroupRate group_rate);
+    ~RateLimiter();
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Book a request and return when it may be sent, for the event loop
+    Clock::time_point ReserveGroup(uint32_t group, Clock::time_point now);
+    Clock::time_point ReserveGlobal(Clock::time_point now);
+    // Both of the above, sleeping until the request may be sent
+    void Acquire(uint32_t group);
+
+ private:
+    static std::unique_ptr<TokenBucket> MakeBucket(double rate);
+    std::atomic<TokenBucket*>& GetGroupSlot(uint32_t group);
+    TokenBucket* GetGroupBucket(uint32_t group);
+
+    std::unique_ptr<TokenBucket> global_;
+    GroupRate group_rate_;
+    // stored for the groups without a limit, never reserved from
+    TokenBucket unlimited_{1, 1};
+    std::array<std::atomic<std::atomic<TokenBucket*>*>, kBlockCount> blocks_;
+};
+
+#endif  // RATE_LIMITER_HPP_
@@ -0,0 +1,72 @@
+#ifndef REQUEST_STATS_HPP_
+#define REQUEST_STATS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "latency_histogram.hpp"
+
+// Where the time of the profile updates went: one latency histogram per
+// status code and phase of the transfer, filled from curl's timing info by
+// both transports. A reused connection has no dns, connect or tls phase and
+// counts as 0 for them.
+class RequestStats {
+ public:
+    enum Phase { Dns = 0, Connect = 1, Tls = 2, FirstByte = 3, Total = 4 };
+    static constexpr size_t kPhaseCount = 5;
+    static constexpr long kMaxStatusCode = 599;
+    // microseconds spent in every phase, first byte and total are counted
+    // from the start of the transfer
+    using Timings = std::array<uint64_t, kPhaseCount>;
+
+    RequestStats();
+    ~RequestStats();
+    RequestStats(const RequestStats&) = delete;
+    RequestStats& operator=(const RequestStats&) = delete;
+
+    // Reads the timings of a finished curl transfer, status_code is 0 for a
+    // transfer that ended without a reply
+    void RecordTransfer(long status_code, void* curl_handle);
+    void Record(long status_code, const Timings& timings);
+
+    // The run the requests per second are measured over
+    void Start();
+    void Stop();
+    std::chrono::microseconds GetElapsed() const;
+    uint64_t GetCount() const;
+    double GetRequestsPerSecond() const;
+    // nullptr until a request got that status code
+    const LatencyHistogram* GetHistogram(long status_code, Phase phase) const;
+    // Duplicates sent for slow requests, and the ones that replied first
+    void CountHedge();
+    void CountHedgeWin();
+    uint64_t GetHedgeCount() const;
+    uint64_t GetHedgeWinCount() const;
+
+    void PrintSummary(std::ostream* out) const;
+    // Returns false if the file can not be written
+    bool WriteJson(const std::string& fname) const;
+
+    static const char* PhaseName(Phase phase);
+
+ private:
+    struct StatusHistograms {
+        std::array<LatencyHistogram, kPhaseCount> phases;
+    };
+
+    // created by the first request that gets the code, never freed before
+    // the stats themselves
+    std::array<std::atomic<StatusHistograms*>, kMaxStatusCode + 1> by_status_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> hedges_{0};
+    std::atomic<uint64_t> hedge_wins_{0};
+    std::chrono::steady_clock::time_point started_;
+    std::chrono::steady_clock::time_point stopped_;
+};
+
+#endif  // REQUEST_STATS_HPP_
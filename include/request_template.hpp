@@ -0,0 +1,39 @@
+#ifndef REQUEST_TEMPLATE_HPP_
+#define REQUEST_TEMPLATE_HPP_
+
+#include <cstdint>
+#include <string>
+
+#include "mac_address.hpp"
+
+// Everything a profile update shares between hosts, serialized once when the
+// updater is built. A transport sizes its url and header buffers with the
+// Init* methods once and then only patches the mac and the client id in
+// place, so building the request of a host does not touch the heap.
+class RequestTemplate {
+ public:
+    static constexpr size_t kMacLength = 17;
+    // "4294967295", the widest client id
+    static constexpr size_t kMaxClientIdDigits = 10;
+
+    RequestTemplate() = default;
+    explicit RequestTemplate(const std::string& url_prefix);
+
+    void InitUrl(std::string* url) const;
+    void PatchUrl(const std::string& mac_addr, std::string* url) const;
+    void PatchUrl(const MacAddress& mac, std::string* url) const;
+
+    void InitClientIdHeader(std::string* header) const;
+    void PatchClientIdHeader(uint32_t client_id, std::string* header) const;
+
+    void FormatTokenHeader(const std::string& token,
+                           std::string* header) const;
+
+    const char* GetContentTypeHeader() const;
+
+ private:
+    // scheme://host:port/profiles/clientId:
+    std::string url_prefix_;
+};
+
+#endif  // REQUEST_TEMPLATE_HPP_
@@ -0,0 +1,61 @@
+#ifndef RETRY_POLICY_HPP_
+#define RETRY_POLICY_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+#include "network_updater.hpp"
+
+// How the hosts whose update failed are retried, by the kind of failure.
+// Loaded from a json file, every class and field being optional:
+//
+//  {
+//    "unauthorized": {"max_retries": 3, "base_delay_ms": 0},
+//    "throttled": {"max_retries": 5, "base_delay_ms": 1000,
+//                  "max_delay_ms": 30000},
+//    "server_error": {"max_retries": 3, "base_delay_ms": 100,
+//                     "max_delay_ms": 10000},
+//    "transport_error": {"max_retries": 3, "base_delay_ms": 200,
+//                        "max_delay_ms": 10000}
+//  }
+//
+// The other 4xx replies mean the request itself is wrong and are never
+// retried.
+struct RetryPolicy {
+    struct Rule {
+        uint32_t max_retries;
+        std::chrono::milliseconds base_delay;
+        std::chrono::milliseconds max_delay;
+    };
+
+    // 401, retried once the token was refreshed
+    Rule unauthorized{NetworkUpdater::kTokenRetryCount,
+                      std::chrono::milliseconds(0),
+                      std::chrono::milliseconds(0)};
+    // 429
+    Rule throttled{5, std::chrono::milliseconds(1000),
+                   std::chrono::milliseconds(30000)};
+    // 5xx
+    Rule server_error{3, std::chrono::milliseconds(100),
+                      std::chrono::milliseconds(10000)};
+    // no reply at all: refused, reset or timed out
+    Rule transport_error{3, std::chrono::milliseconds(200),
+                         std::chrono::milliseconds(10000)};
+
+    // Returns false if the file can not be read or holds an invalid policy
+    bool Load(const char* fname);
+
+    // nullptr for the failures that are not retried
+    const Rule* GetRule(NetworkUpdater::UpdaterErr status,
+                        uint32_t status_code) const;
+
+    // Exponential backoff with equal jitter: base_delay doubled for every
+    // retry already made and capped at max_delay, of which half is waited
+    // and the other half drawn at random so failed hosts do not come back
+    // all at once
+    static std::chrono::milliseconds GetDelay(const Rule& rule, uint32_t retry,
+                                              std::mt19937_64* rng);
+};
+
+#endif  // RETRY_POLICY_HPP_
@@ -0,0 +1,63 @@
+#ifndef RETRY_SCHEDULER_HPP_
+#define RETRY_SCHEDULER_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "mac_address.hpp"
+
+// Hosts waiting for another attempt, kept in a hashed timer wheel: every
+// retry lands in the slot of the millisecond it is due, so scheduling is a
+// push_back and expiring walks only the slots of the time that passed, no
+// matter how many hosts wait. Retries due more than a turn of the wheel away
+// stay in their slot until the turn they are due. Not thread safe.
+class RetryScheduler {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        MacAddress mac;
+        uint32_t group;
+        // retries made so far, including this one
+        uint32_t attempt;
+    };
+
+    static constexpr std::chrono::milliseconds kTick{1};
+    static constexpr size_t kSlotCount = 1024;
+
+    RetryScheduler();
+
+    void Schedule(const Entry& entry, Clock::time_point due);
+    // Takes a retry whose time came, the earliest due first
+    bool PopDue(Clock::time_point now, Entry* entry);
+    // When the next retry is due, in the past if one already is. Only
+    // meaningful when not empty.
+    Clock::time_point GetNextDue() const;
+    size_t size() const;
+    bool empty() const;
+    void Clear();
+
+ private:
+    struct Timer {
+        uint64_t tick;
+        Entry entry;
+    };
+
+    uint64_t ToTick(Clock::time_point time) const;
+    Clock::time_point ToTime(uint64_t tick) const;
+    // Moves the retries due up to tick, included, to due_
+    void Expire(uint64_t tick);
+    void ExpireSlot(std::vector<Timer>* slot, uint64_t tick);
+
+    Clock::time_point epoch_;
+    // first tick not expired yet
+    uint64_t next_tick_{0};
+    std::vector<std::vector<Timer>> slots_;
+    std::deque<Entry> due_;
+    size_t size_{0};
+};
+
+#endif  // RETRY_SCHEDULER_HPP_
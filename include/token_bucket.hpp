@@ -0,0 +1,36 @@
+#ifndef TOKEN_BUCKET_HPP_
+#define TOKEN_BUCKET_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Token bucket kept in its GCRA form: instead of a token count and a refill
+// time it holds the single time at which the bucket runs dry, which callers
+// push forward by one token interval with a compare and swap. Taking a token
+// is lock free and the pacing stays exact at any rate, a caller that wakes
+// up late does not shift the tokens of the ones behind it.
+class TokenBucket {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    // rate in tokens per second, burst tokens can be taken at once after
+    // the bucket was left idle
+    TokenBucket(double rate, double burst);
+
+    // Takes the next token and returns when it may be used, now when the
+    // bucket still had one
+    Clock::time_point Reserve(Clock::time_point now);
+    double GetRate() const;
+
+ private:
+    double rate_;
+    // nanoseconds between two tokens
+    int64_t interval_;
+    // how far the next token may be ahead of now, (burst - 1) intervals
+    int64_t tolerance_;
+    // nanoseconds since the clock epoch, the start of the next free token
+    std::atomic<int64_t> next_token_{0};
+};
+
+#endif  // TOKEN_BUCKET_HPP_
@@ -0,0 +1,27 @@
+#ifndef TOKEN_CACHE_HPP_
+#define TOKEN_CACHE_HPP_
+
+#include <chrono>
+#include <string>
+
+// Keeps the bearer token of a token endpoint in a file between runs, so a
+// run started by cron skips the token round trip while the token it cached
+// last time is still valid. The file is only readable by its owner.
+class TokenCache {
+ public:
+    explicit TokenCache(const std::string& fname);
+
+    // Returns false unless the file holds a token of token_url that stays
+    // valid for more than min_validity. expires_in is set to what is left of
+    // its lifetime, 0 for a token that does not expire.
+    bool Load(const std::string& token_url, std::chrono::seconds min_validity,
+              std::string* token, std::chrono::seconds* expires_in) const;
+    // expires_in 0 stores a token that does not expire
+    bool Store(const std::string& token_url, const std::string& token,
+               std::chrono::seconds expires_in) const;
+
+ private:
+    std::string fname_;
+};
+
+#endif  // TOKEN_CACHE_HPP_
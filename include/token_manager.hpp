@@ -0,0 +1,102 @@
+#ifndef TOKEN_MANAGER_HPP_
+#define TOKEN_MANAGER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Owns the authentication token shared by every request of a run.
+//
+// Readers load the current token through an atomic pointer, without a lock.
+// A refresh is single flight: the caller passes the generation of the token
+// the server refused, the first one fetches a new token under the refresh
+// mutex and the others park on that mutex, find a newer generation once it
+// is released and go on with it. Close to its expiry the first reader that
+// notices refreshes the token while the others keep using the old one,
+// unless the background refresh already replaced it. An event loop can not
+// park, it polls PollRefresh instead and the background refresh fetches.
+class TokenManager {
+ public:
+    enum class RefreshState { Done, Pending, Failed };
+
+    struct Token {
+        std::string value;
+        // 0 until the first token is fetched, then bumped on every refresh
+        uint64_t generation;
+        std::chrono::steady_clock::time_point expires_at;
+        // replaced ahead of the expiry from then on
+        std::chrono::steady_clock::time_point refresh_at;
+    };
+
+    // Fetches a new token, expires_in is left at 0 for a token that does not
+    // expire. Returns false if no token could be obtained.
+    using Fetch = std::function<bool(std::string* token,
+                                     std::chrono::seconds* expires_in)>;
+
+    static constexpr std::chrono::seconds kDefaultRefreshMargin{30};
+    // wait before a failed fetch is tried again
+    static constexpr std::chrono::seconds kRefreshRetryDelay{5};
+
+    explicit TokenManager(Fetch fetch, std::chrono::seconds refresh_margin =
+                                           kDefaultRefreshMargin);
+    ~TokenManager();
+    TokenManager(const TokenManager&) = delete;
+    TokenManager& operator=(const TokenManager&) = delete;
+
+    // The returned token stays valid for the lifetime of the manager
+    const Token& Current();
+    // Current without the refresh, the token may be expired
+    const Token& Peek() const;
+    // Returns false if the token of that generation had to be replaced and
+    // the fetch failed. Within kRefreshRetryDelay of a failed fetch the
+    // token is not asked for again, the refresh fails at once.
+    bool Refresh(uint64_t generation);
+    // Refresh that never waits for the token endpoint: Done once the token
+    // of that generation was replaced, Failed like Refresh would, else asks
+    // the background refresh to replace it and returns Pending. Needs
+    // StartBackgroundRefresh.
+    RefreshState PollRefresh(uint64_t generation);
+    uint64_t GetRefreshCount() const;
+    std::chrono::seconds GetRefreshMargin() const;
+
+    // Replaces the token refresh_margin before it expires, or half way
+    // through a shorter lifetime, from a thread of its own, so no request has
+    // to wait for the token endpoint
+    void StartBackgroundRefresh();
+
+ private:
+    void Publish(std::string value, std::chrono::seconds expires_in);
+    void BackgroundRefresh();
+    // Under wait_mutex_
+    bool FailedRecently(uint64_t generation) const;
+
+    Fetch fetch_;
+    std::chrono::seconds refresh_margin_;
+    std::atomic<const Token*> current_;
+    std::atomic<bool> refresh_pending_{false};
+    std::atomic<uint64_t> refresh_count_{0};
+    std::mutex refresh_mutex_;
+    // replaced tokens are kept, a reader may still hold a reference to them
+    std::vector<std::unique_ptr<Token>> tokens_;
+
+    std::thread refresher_;
+    // wakes the refresher on a new token, a polled refresh or when the
+    // manager goes away
+    std::mutex wait_mutex_;
+    std::condition_variable wake_;
+    bool stopping_{false};
+    // generation PollRefresh asked to replace
+    uint64_t polled_generation_{UINT64_MAX};
+    // generation the last fetch failed for and when, under wait_mutex_
+    uint64_t failed_generation_{UINT64_MAX};
+    std::chrono::steady_clock::time_point failed_at_;
+};
+
+#endif  // TOKEN_MANAGER_HPP_
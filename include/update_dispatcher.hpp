@@ -0,0 +1,102 @@
+#ifndef UPDATE_DISPATCHER_HPP_
+#define UPDATE_DISPATCHER_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+
+#include "concurrency_limiter.hpp"
+#include "mac_address.hpp"
+#include "mac_set.hpp"
+#include "network_updater.hpp"
+#include "rate_limiter.hpp"
+#include "retry_policy.hpp"
+#include "retry_scheduler.hpp"
+
+// Fans the per-host updates out over several worker threads or, in event loop
+// mode, over the in-flight transfers of a single MultiTransport. A host whose
+// update failed waits for its retry in a RetryScheduler while the workers go
+// on with the fresh hosts, a due retry goes before them.
+class UpdateDispatcher {
+ public:
+    enum Mode { Threads = 0, EventLoop = 1 };
+
+    UpdateDispatcher(NetworkUpdater* updater, std::ostream* log,
+                     uint32_t concurrency, bool fail_fast,
+                     Mode mode = Mode::Threads);
+    ~UpdateDispatcher() = default;
+
+    // The concurrency becomes the highest number of requests in flight, the
+    // limiter finds how many of them the server sustains
+    void SetAdaptiveConcurrency(bool adaptive);
+    // nullptr unless the concurrency is adaptive
+    const ConcurrencyLimiter* GetLimiter() const;
+    // Paces the updates to global_rate requests per second and, when the
+    // updater groups the hosts, every group to its entry in group_rates or
+    // else to group_rate. A rate of 0 leaves that budget unlimited.
+    void SetRateLimit(double global_rate, double group_rate,
+                      const std::map<std::string, double>& group_rates);
+    void SetRetryPolicy(const RetryPolicy& policy);
+    // Duplicates the requests slower than the p95 on a few spare slots.
+    // Event loop mode only, a worker thread is blocked in its request.
+    void SetHedging(bool enabled);
+
+    // Returns Fail if the run was aborted by fail-fast, Ok otherwise
+    NetworkUpdater::UpdaterErr Run();
+
+ private:
+    using Host = RetryScheduler::Entry;
+
+    void RunEventLoop();
+    void Worker();
+    // Next mac to update, from the loaded list or the streamed hosts file
+    bool NextHost(MacAddress* mac, uint32_t* group);
+    // A due retry or else a fresh host, returns false once none is left.
+    // Waits for the retries to come due in the worker threads only.
+    bool NextAttempt(Host* host, bool wait);
+    void UpdateHost(const Host& host, NetworkUpdater::RequestBuffers* buffers);
+    // SendRequest within the rate and concurrency limits, failed at once
+    // while the circuit breaker is open
+    NetworkUpdater::UpdaterErr Send(const MacAddress& mac, uint32_t group,
+                                    NetworkUpdater::RequestBuffers* buffers,
+                                    uint32_t* status_code);
+    // Schedules the retry of a failed host, reports it once the policy gives
+    // up on it
+    void FinishAttempt(const Host& host, NetworkUpdater::UpdaterErr status,
+                       uint32_t status_code);
+    void ReportFailure(const MacAddress& mac);
+    void Log(const std::string& line);
+
+    NetworkUpdater* updater_;
+    std::ostream* log_;
+    uint32_t concurrency_;
+    bool fail_fast_;
+    Mode mode_;
+    std::unique_ptr<ConcurrencyLimiter> limiter_;
+    std::unique_ptr<RateLimiter> rate_limiter_;
+    RetryPolicy retry_policy_;
+    bool hedging_{false};
+    std::atomic<size_t> next_host_{0};
+    std::atomic<bool> aborted_{false};
+    std::mutex log_mutex_;
+    std::mutex reader_mutex_;
+    // hosts already handed out while streaming, guarded by reader_mutex_
+    MacSet streamed_hosts_;
+    std::mutex retry_mutex_;
+    std::condition_variable retry_changed_;
+    // guarded by retry_mutex_
+    RetryScheduler retries_;
+    std::mt19937_64 jitter_{std::random_device()()};
+    bool hosts_done_{false};
+    // attempts handed out and not finished, they may still schedule a retry,
+    // and the fresh hosts being looked up
+    uint32_t in_progress_{0};
+};
+
+#endif  // UPDATE_DISPATCHER_HPP_
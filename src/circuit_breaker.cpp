@@ -0,0 +1,125 @@
+#include <algorithm>
+
+#include "../include/circuit_breaker.hpp"
+
+constexpr size_t CircuitBreaker::kWindowSize;
+constexpr size_t CircuitBreaker::kMinRequests;
+constexpr double CircuitBreaker::kDefaultFailureRatio;
+constexpr std::chrono::milliseconds CircuitBreaker::kDefaultOpenTime;
+constexpr std::chrono::milliseconds CircuitBreaker::kMaxOpenTime;
+
+void CircuitBreaker::Configure(double failure_ratio,
+                               std::chrono::milliseconds open_time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    enabled_ = failure_ratio > 0;
+    failure_ratio_ = failure_ratio;
+    min_open_time_ = std::max(open_time, std::chrono::milliseconds(1));
+    open_time_ = min_open_time_;
+    state_ = State::Closed;
+    probing_ = false;
+    ResetWindow();
+}
+
+bool CircuitBreaker::Allow(bool* probe) {
+    *probe = false;
+    if (!enabled_ || state_.load(std::memory_order_acquire) == State::Closed) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == State::Open) {
+        if (Clock::now() < open_until_) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        state_ = State::HalfOpen;
+        probing_ = false;
+    }
+
+    // a single probe at a time
+    if (state_ == State::HalfOpen) {
+        if (probing_) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        probing_ = true;
+        *probe = true;
+    }
+    return true;
+}
+
+void CircuitBreaker::Record(bool failed, bool probe) {
+    if (!enabled_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (state_.load(std::memory_order_relaxed)) {
+        // the requests sent before the breaker tripped change nothing
+        case State::Open:
+            return;
+
+        // nor do the ones still running from the closed period
+        case State::HalfOpen:
+            if (!probe) {
+                return;
+            }
+            probing_ = false;
+            if (failed) {
+                open_time_ = std::min(open_time_ * 2, kMaxOpenTime);
+                Trip(Clock::now());
+            } else {
+                open_time_ = min_open_time_;
+                state_ = State::Closed;
+            }
+            return;
+
+        case State::Closed:
+            break;
+    }
+
+    if (outcomes_ == kWindowSize) {
+        failures_ -= window_[next_outcome_];
+    } else {
+        outcomes_++;
+    }
+    window_[next_outcome_] = failed;
+    failures_ += failed;
+    next_outcome_ = (next_outcome_ + 1) % kWindowSize;
+
+    if (outcomes_ >= kMinRequests &&
+        failures_ >= failure_ratio_ * outcomes_) {
+        Trip(Clock::now());
+    }
+}
+
+void CircuitBreaker::Trip(Clock::time_point now) {
+    state_ = State::Open;
+    open_until_ = now + open_time_;
+    trips_++;
+    // the next closed period starts over
+    ResetWindow();
+}
+
+void CircuitBreaker::ResetWindow() {
+    next_outcome_ = 0;
+    outcomes_ = 0;
+    failures_ = 0;
+}
+
+CircuitBreaker::State CircuitBreaker::GetState() const {
+    return state_.load(std::memory_order_acquire);
+}
+
+uint64_t CircuitBreaker::GetTripCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return trips_;
+}
+
+uint64_t CircuitBreaker::GetRejectedCount() const {
+    return rejected_.load(std::memory_order_relaxed);
+}
+
+bool CircuitBreaker::IsFailure(long status_code) {
+    return status_code == 0 || status_code >= 500;
+}
@@ -0,0 +1,42 @@
+#include <random>
+
+#include "../include/client_id_generator.hpp"
+
+namespace {
+
+uint64_t SplitMix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t SeedThread() {
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+}  // namespace
+
+ClientIdGenerator::ClientIdGenerator(uint32_t max_id) : max_id_(max_id) {}
+
+void ClientIdGenerator::SetUnique(bool unique) {
+    unique_ = unique;
+    next_id_ = 1;
+}
+
+bool ClientIdGenerator::IsUnique() const {
+    return unique_;
+}
+
+uint32_t ClientIdGenerator::Next() {
+    if (unique_) {
+        return next_id_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // seeded on the first id a thread asks for
+    thread_local uint64_t state = SeedThread();
+    // the high 32 bits scaled to 0..max_id - 1, no division needed
+    uint64_t bits = SplitMix64(&state) >> 32;
+    return static_cast<uint32_t>((bits * max_id_) >> 32) + 1;
+}
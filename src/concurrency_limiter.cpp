@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "../include/concurrency_limiter.hpp"
+
+constexpr uint32_t ConcurrencyLimiter::kDefaultInitialLimit;
+constexpr size_t ConcurrencyLimiter::kMinWindowSamples;
+constexpr double ConcurrencyLimiter::kBackoffRatio;
+constexpr double ConcurrencyLimiter::kLatencyTolerance;
+constexpr double ConcurrencyLimiter::kDropTolerance;
+constexpr double ConcurrencyLimiter::kBaselineWeight;
+
+ConcurrencyLimiter::ConcurrencyLimiter(uint32_t min_limit, uint32_t max_limit,
+                                       uint32_t initial_limit)
+    : min_limit_(std::max<uint32_t>(min_limit, 1)),
+      max_limit_(std::max(max_limit, min_limit_)),
+      limit_(std::min(std::max(initial_limit, min_limit_), max_limit_)) {
+    window_latencies_.reserve(std::max<size_t>(kMinWindowSamples, max_limit_));
+}
+
+void ConcurrencyLimiter::Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [this]() {
+        return in_flight_ < static_cast<uint32_t>(limit_);
+    });
+    in_flight_++;
+    window_max_in_flight_ = std::max(window_max_in_flight_, in_flight_);
+}
+
+bool ConcurrencyLimiter::TryAcquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_flight_ >= static_cast<uint32_t>(limit_)) {
+        return false;
+    }
+    in_flight_++;
+    window_max_in_flight_ = std::max(window_max_in_flight_, in_flight_);
+    return true;
+}
+
+void ConcurrencyLimiter::Release(std::chrono::microseconds latency,
+                                 bool dropped) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_--;
+    window_dropped_ += dropped ? 1 : 0;
+    window_latencies_.push_back(latency.count());
+    if (window_latencies_.size() >=
+        std::max<size_t>(kMinWindowSamples, static_cast<size_t>(limit_))) {
+        CloseWindow();
+    }
+
+    // a raised limit may let several waiting workers go
+    released_.notify_all();
+}
+
+// Called with mutex_ held
+void ConcurrencyLimiter::CloseWindow() {
+    auto p99 = window_latencies_.begin() + window_latencies_.size() * 99 / 100;
+    std::nth_element(window_latencies_.begin(), p99, window_latencies_.end());
+    double window_p99 = static_cast<double>(*p99);
+
+    bool overloaded =
+        window_dropped_ > window_latencies_.size() * kDropTolerance ||
+        (baseline_p99_ > 0 && window_p99 > baseline_p99_ * kLatencyTolerance);
+    if (overloaded) {
+        limit_ = std::max<double>(limit_ * kBackoffRatio, min_limit_);
+        slow_start_ = false;
+    } else if (window_max_in_flight_ >= static_cast<uint32_t>(limit_)) {
+        // only a limit the requests ran into is worth raising
+        limit_ = std::min<double>(slow_start_ ? limit_ * 2 : limit_ + 1,
+                                  max_limit_);
+    }
+
+    if (baseline_p99_ == 0) {
+        baseline_p99_ = window_p99;
+    } else {
+        baseline_p99_ += (window_p99 - baseline_p99_) * kBaselineWeight;
+    }
+
+    window_latencies_.clear();
+    window_dropped_ = 0;
+    window_max_in_flight_ = in_flight_;
+}
+
+uint32_t ConcurrencyLimiter::GetLimit() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<uint32_t>(limit_);
+}
+
+uint32_t ConcurrencyLimiter::GetInFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_flight_;
+}
+
+bool ConcurrencyLimiter::IsDropped(uint32_t status_code) {
+    return status_code == 0 || status_code >= 500;
+}
@@ -0,0 +1,101 @@
+#include <cpr/cpr.h>
+#include <vector>
+
+#include "../include/connection_pool.hpp"
+
+constexpr size_t ConnectionPool::kDefaultPoolSize;
+constexpr std::chrono::seconds ConnectionPool::kDefaultIdleTimeout;
+
+ConnectionPool::ConnectionPool(size_t pool_size,
+                               std::chrono::seconds idle_timeout)
+    : pool_size_(pool_size), idle_timeout_(idle_timeout) {}
+
+ConnectionPool::~ConnectionPool() = default;
+
+void ConnectionPool::Configure(size_t pool_size,
+                               std::chrono::seconds idle_timeout) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pool_size_ = pool_size;
+    idle_timeout_ = idle_timeout;
+}
+
+size_t ConnectionPool::GetPoolSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pool_size_;
+}
+
+std::chrono::seconds ConnectionPool::GetIdleTimeout() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_timeout_;
+}
+
+std::unique_ptr<cpr::Session> ConnectionPool::Acquire(
+    const std::string& destination, bool* created) {
+    auto now = std::chrono::steady_clock::now();
+    std::unique_ptr<cpr::Session> session;
+    // a deque would allocate even when nothing expired
+    std::vector<IdleSession> expired;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = idle_sessions_.find(destination);
+        if (it != idle_sessions_.end()) {
+            std::deque<IdleSession>& idle = it->second;
+            // the oldest sessions sit at the front
+            while (!idle.empty() &&
+                   now - idle.front().released_at > idle_timeout_) {
+                expired.push_back(std::move(idle.front()));
+                idle.pop_front();
+            }
+
+            if (!idle.empty()) {
+                session = std::move(idle.back().session);
+                idle.pop_back();
+            }
+        }
+    }
+
+    // closing the expired connections is done outside the lock
+    sessions_evicted_ += expired.size();
+    expired.clear();
+
+    *created = !session;
+    if (session) {
+        sessions_reused_++;
+        return session;
+    }
+
+    sessions_created_++;
+    session = std::make_unique<cpr::Session>();
+    curl_easy_setopt(session->GetCurlHolder()->handle, CURLOPT_MAXAGE_CONN,
+                     static_cast<long>(GetIdleTimeout().count()));
+    return session;
+}
+
+void ConnectionPool::Release(const std::string& destination,
+                             std::unique_ptr<cpr::Session> session) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::deque<IdleSession>& idle = idle_sessions_[destination];
+        if (idle.size() < pool_size_) {
+            idle.push_back(
+                {std::move(session), std::chrono::steady_clock::now()});
+            return;
+        }
+    }
+
+    sessions_evicted_++;
+}
+
+void ConnectionPool::CountConnection(bool reused) {
+    if (reused) {
+        connections_reused_++;
+    } else {
+        connections_opened_++;
+    }
+}
+
+ConnectionPool::Stats ConnectionPool::GetStats() const {
+    return {sessions_created_, sessions_reused_, sessions_evicted_,
+            connections_opened_, connections_reused_};
+}
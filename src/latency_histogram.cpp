@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cmath>
+
+#include "../include/latency_histogram.hpp"
+
+constexpr uint32_t LatencyHistogram::kSubBucketBits;
+constexpr uint32_t LatencyHistogram::kMaxValueBits;
+
+size_t LatencyHistogram::BucketOf(uint64_t value) {
+    value = std::min<uint64_t>(value, (uint64_t{1} << kMaxValueBits) - 1);
+    if (value < kSubBucketCount) {
+        return value;
+    }
+
+    // the top kSubBucketBits + 1 bits of the value pick the bucket
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t shift = exponent - kSubBucketBits;
+    return (shift + 1) * kSubBucketCount + (value >> shift) - kSubBucketCount;
+}
+
+uint64_t LatencyHistogram::HighestValueOf(size_t bucket) {
+    if (bucket < kSubBucketCount) {
+        return bucket;
+    }
+
+    uint32_t shift = bucket / kSubBucketCount - 1;
+    uint64_t mantissa = bucket % kSubBucketCount + kSubBucketCount;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+    counts_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetMax() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::GetMean() const {
+    uint64_t count = GetCount();
+    return count == 0 ? 0 : static_cast<double>(sum_) / count;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile) const {
+    uint64_t count = GetCount();
+    if (count == 0) {
+        return 0;
+    }
+
+    percentile = std::min(std::max(percentile, 0.0), 100.0);
+    uint64_t rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(percentile / 100 * count)));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < kBucketCount; bucket++) {
+        seen += counts_[bucket].load(std::memory_order_relaxed);
+        // the last bucket also holds every value too large for the others
+        if (seen >= rank) {
+            return bucket + 1 < kBucketCount
+                       ? std::min(HighestValueOf(bucket), GetMax())
+                       : GetMax();
+        }
+    }
+    return GetMax();
+}
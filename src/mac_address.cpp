@@ -0,0 +1,175 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+
+#include "../include/mac_address.hpp"
+#include "../include/mac_set.hpp"
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+constexpr size_t kPrefetchDistance = 16;
+
+int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool IsSeparator(char c) {
+    return c == ':' || c == '-';
+}
+
+#if defined(__SSE2__)
+// bits of the separator positions 2, 5, 8, 11 and 14 in the first 16 bytes
+constexpr int kSeparatorBits = 0x4924;
+constexpr int kHexBits = 0xffff & ~kSeparatorBits;
+
+// Checks and converts the first 16 characters in one go: every byte is
+// classified as digit, letter or separator and turned into its nibble, the
+// 17th character is handled by the caller.
+bool ParseSse2(const char* text, uint8_t* nibbles) {
+    const __m128i chars =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(text));
+    const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+
+    const __m128i is_digit =
+        _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                      _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    const __m128i is_letter =
+        _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                      _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    const int hex = _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter));
+    const int colons =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8(':')));
+    const int dashes =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('-')));
+
+    if ((hex & kHexBits) != kHexBits) {
+        return false;
+    }
+    if ((colons & kSeparatorBits) != kSeparatorBits &&
+        (dashes & kSeparatorBits) != kSeparatorBits) {
+        return false;
+    }
+
+    const __m128i digit_values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i letter_values = _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10));
+    const __m128i values =
+        _mm_or_si128(_mm_and_si128(is_digit, digit_values),
+                     _mm_andnot_si128(is_digit, letter_values));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(nibbles), values);
+    return true;
+}
+#endif
+
+}  // namespace
+
+constexpr size_t MacAddress::kTextLength;
+
+bool MacAddress::Parse(std::string_view text, MacAddress* mac) {
+#if defined(__SSE2__)
+    if (text.size() != kTextLength) {
+        return false;
+    }
+
+    uint8_t nibbles[16];
+    int last = HexValue(text[kTextLength - 1]);
+    if (last < 0 || !ParseSse2(text.data(), nibbles)) {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < 15; i += 3) {
+        value = (value << 8) | (nibbles[i] << 4) | nibbles[i + 1];
+    }
+    value = (value << 8) | (nibbles[15] << 4) | last;
+
+    *mac = MacAddress(value);
+    return true;
+#else
+    return ParseScalar(text, mac);
+#endif
+}
+
+bool MacAddress::ParseScalar(std::string_view text, MacAddress* mac) {
+    if (text.size() != kTextLength) {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < kTextLength; i += 3) {
+        int high = HexValue(text[i]);
+        int low = HexValue(text[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        if (i + 2 < kTextLength &&
+            (!IsSeparator(text[i + 2]) || text[i + 2] != text[2])) {
+            return false;
+        }
+
+        value = (value << 8) | static_cast<uint64_t>(high << 4 | low);
+    }
+
+    *mac = MacAddress(value);
+    return true;
+}
+
+void MacAddress::Format(char* out) const {
+    for (size_t i = 0; i < 6; i++) {
+        uint8_t octet = static_cast<uint8_t>(value_ >> (40 - 8 * i));
+        out[3 * i] = kHexDigits[octet >> 4];
+        out[3 * i + 1] = kHexDigits[octet & 0xf];
+        if (i < 5) {
+            out[3 * i + 2] = ':';
+        }
+    }
+}
+
+std::string MacAddress::ToString() const {
+    std::string text(kTextLength, '0');
+    Format(&text[0]);
+    return text;
+}
+
+size_t MacList::RemoveDuplicates() {
+    MacSet seen(macs_.size());
+    size_t kept = 0;
+    for (size_t i = 0; i < macs_.size(); i++) {
+        // the table is far bigger than the cache, start loading the slot
+        // of a later host while this one is probed
+        if (i + kPrefetchDistance < macs_.size()) {
+            seen.prefetch(macs_[i + kPrefetchDistance]);
+        }
+        if (seen.insert(macs_[i])) {
+            if (i < groups_.size()) {
+                groups_[kept] = groups_[i];
+            }
+            macs_[kept++] = macs_[i];
+        }
+    }
+
+    size_t removed = macs_.size() - kept;
+    macs_.resize(kept);
+    groups_.resize(std::min(groups_.size(), kept));
+    return removed;
+}
+
+std::vector<std::string> MacList::ToStrings() const {
+    std::vector<std::string> text;
+    text.reserve(macs_.size());
+    for (const auto& mac : macs_) {
+        text.push_back(mac.ToString());
+    }
+    return text;
+}
@@ -0,0 +1,103 @@
+#include <sys/mman.h>
+#include <cstring>
+
+#include "../include/mac_list_reader.hpp"
+
+namespace {
+
+constexpr std::string_view kHeaderMarker = "mac";
+
+bool IsTrimmed(char c) {
+    return c == '"' || c == '\r';
+}
+
+bool IsTrimmedColumn(char c) {
+    return IsTrimmed(c) || c == ' ' || c == '\t';
+}
+
+}  // namespace
+
+bool MacListReader::Open(const char* hosts_fname) {
+    if (!file_.Load(hosts_fname)) {
+        return false;
+    }
+
+    // the file is read front to back exactly once
+    if (file_.size() > 0) {
+        madvise(const_cast<char*>(file_.data()), file_.size(),
+                MADV_SEQUENTIAL);
+    }
+
+    Rewind();
+    return true;
+}
+
+bool MacListReader::Next(std::string_view* mac_addr) {
+    const char* data = file_.data();
+    const size_t size = file_.size();
+
+    while (offset_ < size) {
+        const char* line = data + offset_;
+        size_t remaining = size - offset_;
+        auto* line_end =
+            static_cast<const char*>(memchr(line, '\n', remaining));
+        size_t line_size = line_end ? line_end - line : remaining;
+        offset_ += line_size + 1;
+        line_number_++;
+
+        std::string_view line_view(line, line_size);
+        auto* field_end =
+            static_cast<const char*>(memchr(line, ',', line_size));
+        std::string_view field(line, field_end ? field_end - line : line_size);
+        while (!field.empty() && IsTrimmed(field.front())) {
+            field.remove_prefix(1);
+        }
+        while (!field.empty() && IsTrimmed(field.back())) {
+            field.remove_suffix(1);
+        }
+
+        // only the first line may name the columns, a "mac" further down
+        // is a host row and is rejected by the caller if it is not a mac
+        if (field.empty() || (line_number_ == 1 &&
+                              field.substr(0, kHeaderMarker.size()) ==
+                                  kHeaderMarker)) {
+            continue;
+        }
+
+        line_ = line_view;
+        *mac_addr = field;
+        return true;
+    }
+
+    return false;
+}
+
+std::string_view MacListReader::GetColumn(size_t column) const {
+    std::string_view field = line_;
+    for (size_t i = 0; i < column; i++) {
+        size_t comma = field.find(',');
+        if (comma == std::string_view::npos) {
+            return std::string_view();
+        }
+        field.remove_prefix(comma + 1);
+    }
+    field = field.substr(0, field.find(','));
+
+    while (!field.empty() && IsTrimmedColumn(field.front())) {
+        field.remove_prefix(1);
+    }
+    while (!field.empty() && IsTrimmedColumn(field.back())) {
+        field.remove_suffix(1);
+    }
+    return field;
+}
+
+void MacListReader::Rewind() {
+    offset_ = 0;
+    line_number_ = 0;
+    line_ = std::string_view();
+}
+
+size_t MacListReader::GetLineNumber() const {
+    return line_number_;
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include "../include/mac_set.hpp"
+
+namespace {
+
+constexpr size_t kMinCapacity = 16;
+
+// splitmix64 finalizer, spreads the vendor prefix shared by many hosts
+uint64_t Mix(uint64_t key) {
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+}  // namespace
+
+MacSet::MacSet(size_t expected_count) {
+    reserve(expected_count);
+}
+
+void MacSet::reserve(size_t expected_count) {
+    size_t capacity = kMinCapacity;
+    while (capacity * 3 < 4 * expected_count) {
+        capacity <<= 1;
+    }
+    if (capacity <= slots_.size()) {
+        return;
+    }
+
+    std::vector<uint64_t> old_slots(capacity, 0);
+    old_slots.swap(slots_);
+    mask_ = capacity - 1;
+    for (uint64_t key : old_slots) {
+        if (key != 0) {
+            slots_[SlotOf(key)] = key;
+        }
+    }
+}
+
+bool MacSet::insert(const MacAddress& mac) {
+    if (4 * (size_ + 1) > 3 * slots_.size()) {
+        Grow();
+    }
+
+    uint64_t key = mac.value() + 1;
+    size_t slot = SlotOf(key);
+    if (slots_[slot] == key) {
+        return false;
+    }
+
+    slots_[slot] = key;
+    size_++;
+    return true;
+}
+
+bool MacSet::contains(const MacAddress& mac) const {
+    if (slots_.empty()) {
+        return false;
+    }
+
+    uint64_t key = mac.value() + 1;
+    return slots_[SlotOf(key)] == key;
+}
+
+void MacSet::prefetch(const MacAddress& mac) const {
+    if (!slots_.empty()) {
+        __builtin_prefetch(&slots_[Mix(mac.value() + 1) & mask_]);
+    }
+}
+
+void MacSet::clear() {
+    std::fill(slots_.begin(), slots_.end(), 0);
+    size_ = 0;
+}
+
+// linear probing, returns the slot holding key or the empty one it goes to
+size_t MacSet::SlotOf(uint64_t key) const {
+    size_t slot = Mix(key) & mask_;
+    while (slots_[slot] != 0 && slots_[slot] != key) {
+        slot = (slot + 1) & mask_;
+    }
+    return slot;
+}
+
+void MacSet::Grow() {
+    reserve(std::max(kMinCapacity, slots_.size()));
+}
@@ -1,20 +1,31 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <stdexcept>
+#include <string>
 
 #include "../include/network_updater.hpp"
+#include "../include/retry_policy.hpp"
+#include "../include/update_dispatcher.hpp"
 
 const char default_json_config[] = "../resources/versions.json";
 const char default_host_file[] = "../resources/input.csv";
-uint32_t NetworkUpdater::kTokenRetryCount = 3;
 const char default_log_file[] = "../logs/result.log";
+const char default_token_cache[] = "../logs/token_cache.json";
 
 static void ShowHelp() {
     std::cout
         << "Usage: ./network_updater [-h] [-j <file>] [-m <file>] [-u "
-           "<url>] [-p <port_no>] [-l <logfile>] [-f {0|1}]\n"
+           "<url>] [-p <port_no>] [-l <logfile>] [-f {0|1}] [-c <count>] "
+           "[-e {0|1}] [-A {0|1}] [-P <count>] [-I <seconds>] "
+           "[-2 {0|1}] [-S <count>] [-s {0|1}] [-U {0|1}] "
+           "[-t <url>] [-T <file>] [-r <file>] [-R <rate>] "
+           "[-g <column>] [-G <rate>[,<group>=<rate>...]] [-y <file>] "
+           "[-k <ms>] [-o <ms>] [-H {0|1}] [-b <percent>] [-B <ms>]\n"
         << "\t-h,--help\tShow this help message\n"
         << "\t-j,--json\tPath of the json config file to be added in "
            "the HTTP request\n"
@@ -26,9 +37,91 @@ static void ShowHelp() {
         << "\t-l,--log-file\tLocation of the logs describing the host result\n"
         << "\t-f,--fail-fast\tThe execution should exit at the first failed "
            "request\n"
+        << "\t-c,--concurrency\tNumber of requests sent in parallel. "
+           "Default is 1\n"
+        << "\t-e,--event-loop\tDrive all the requests from a single thread "
+           "through curl's multi interface instead of one thread per request\n"
+        << "\t-A,--adaptive\tRaise the requests in flight while the latency "
+           "stays flat and back off on 5xx replies, timeouts or a rising "
+           "p99. The concurrency becomes the upper limit\n"
+        << "\t-P,--pool-size\tNumber of idle keep-alive connections kept "
+           "per destination, below the concurrency the extra workers open "
+           "a new connection for most hosts. Default is the concurrency, "
+           "at least 8\n"
+        << "\t-I,--idle-timeout\tSeconds after which an idle connection "
+           "is closed. Default is 30\n"
+        << "\t-2,--http2\tMultiplex the requests as HTTP/2 streams (h2c "
+           "for http:// destinations)\n"
+        << "\t-S,--max-streams\tMaximum number of concurrent HTTP/2 "
+           "streams per connection. Default is 100\n"
+        << "\t-s,--stream-hosts\tRead the hosts file while the requests "
+           "are sent instead of loading it first\n"
+        << "\t-U,--unique-ids\tNever send the same client id twice in a "
+           "run instead of picking random ones\n"
+        << "\t-t,--token-url\tToken endpoint the bearer tokens are requested "
+           "from. Without it a fixed test token is sent\n"
+        << "\t-T,--token-cache\tFile the token is kept in between runs. "
+           "Default is ../logs/token_cache.json\n"
+        << "\t-r,--report\tWrite the request count, requests/s and "
+           "latency percentiles per status code to a json file\n"
+        << "\t-R,--rate\tMaximum number of requests per second over all the "
+           "hosts. Default is 0, no limit\n"
+        << "\t-g,--group-column\tColumn of the hosts file the hosts are "
+           "grouped by, 1 to 3 for id1 to id3. Default is 0, no groups\n"
+        << "\t-G,--group-rate\tMaximum number of requests per second of "
+           "every group, followed by the groups with a rate of their own. "
+           "Default is 0, no limit\n"
+        << "\t-y,--retry-policy\tJson file with the retries and backoff "
+           "of the 401, 429, 5xx and transport failures\n"
+        << "\t-k,--connect-timeout\tMilliseconds allowed to connect to the "
+           "server, 0 for no limit. Default is 5000\n"
+        << "\t-o,--timeout\tMilliseconds allowed for a whole request, 0 "
+           "for no limit. Default is 30000\n"
+        << "\t-H,--hedge\tSend a duplicate of the requests slower than the "
+           "p95 on a few spare slots, the first reply wins. Event "
+           "loop mode only\n"
+        << "\t-b,--circuit-breaker\tPercentage of 5xx replies and requests "
+           "without a reply that stops sending to the server for a while, "
+           "0 to never stop. Default is 50\n"
+        << "\t-B,--breaker-open\tMilliseconds the requests fail at once "
+           "after the breaker tripped, before a probe is sent. Default is "
+           "1000\n"
         << std::endl;
 }
 
+// "<rate>[,<group>=<rate>...]"
+static bool ParseGroupRates(const std::string& text, double* group_rate,
+                            std::map<std::string, double>* group_rates) {
+    size_t start = 0;
+    bool first = true;
+    while (start <= text.size()) {
+        size_t end = std::min(text.find(',', start), text.size());
+        std::string item = text.substr(start, end - start);
+        start = end + 1;
+
+        size_t equal = item.find('=');
+        if (first != (equal == std::string::npos) || item.empty()) {
+            return false;
+        }
+
+        char* rate_end = nullptr;
+        const char* rate = item.c_str() + (first ? 0 : equal + 1);
+        double value = strtod(rate, &rate_end);
+        if (rate_end == rate || *rate_end != '\0' || value < 0) {
+            return false;
+        }
+
+        if (first) {
+            *group_rate = value;
+        } else {
+            (*group_rates)[item.substr(0, equal)] = value;
+        }
+        first = false;
+    }
+
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     const char* host_file = default_host_file;
     const char* json_config = default_json_config;
@@ -36,6 +129,31 @@ int main(int argc, char* argv[]) {
     int port = 8080;
     const char* log_file = default_log_file;
     bool fast_exit = false;
+    uint32_t concurrency = 1;
+    UpdateDispatcher::Mode mode = UpdateDispatcher::Mode::Threads;
+    bool adaptive = false;
+    size_t pool_size = ConnectionPool::kDefaultPoolSize;
+    bool pool_size_set = false;
+    std::chrono::seconds idle_timeout = ConnectionPool::kDefaultIdleTimeout;
+    bool http2 = false;
+    uint32_t max_streams = NetworkUpdater::kDefaultMaxStreams;
+    bool stream_hosts = false;
+    bool unique_ids = false;
+    const char* token_url = nullptr;
+    const char* token_cache = default_token_cache;
+    const char* report_file = nullptr;
+    double rate = 0;
+    size_t group_column = 0;
+    double group_rate = 0;
+    std::map<std::string, double> group_rates;
+    RetryPolicy retry_policy;
+    std::chrono::milliseconds connect_timeout =
+        NetworkUpdater::kDefaultConnectTimeout;
+    std::chrono::milliseconds request_timeout =
+        NetworkUpdater::kDefaultRequestTimeout;
+    bool hedging = false;
+    double breaker_ratio = CircuitBreaker::kDefaultFailureRatio;
+    std::chrono::milliseconds breaker_open = CircuitBreaker::kDefaultOpenTime;
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -85,6 +203,157 @@ int main(int argc, char* argv[]) {
             }
             int fex = atoi(argv[i + 1]);
             fast_exit = (fex != 0);
+        } else if ((arg == "-c") || (arg == "--concurrency")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                std::cout << "Invalid concurrency option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            concurrency = atoi(argv[i + 1]);
+        } else if ((arg == "-e") || (arg == "--event-loop")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid event loop option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            if (atoi(argv[i + 1]) != 0) {
+                mode = UpdateDispatcher::Mode::EventLoop;
+            }
+        } else if ((arg == "-A") || (arg == "--adaptive")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid adaptive option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            adaptive = (atoi(argv[i + 1]) != 0);
+        } else if ((arg == "-P") || (arg == "--pool-size")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+                std::cout << "Invalid pool size option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            pool_size = atoi(argv[i + 1]);
+            pool_size_set = true;
+        } else if ((arg == "-I") || (arg == "--idle-timeout")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+                std::cout << "Invalid idle timeout option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            idle_timeout = std::chrono::seconds(atoi(argv[i + 1]));
+        } else if ((arg == "-2") || (arg == "--http2")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid http2 option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            http2 = (atoi(argv[i + 1]) != 0);
+        } else if ((arg == "-S") || (arg == "--max-streams")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                std::cout << "Invalid max streams option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            max_streams = atoi(argv[i + 1]);
+        } else if ((arg == "-s") || (arg == "--stream-hosts")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid stream hosts option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            stream_hosts = (atoi(argv[i + 1]) != 0);
+        } else if ((arg == "-U") || (arg == "--unique-ids")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid unique ids option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            unique_ids = (atoi(argv[i + 1]) != 0);
+        } else if ((arg == "-t") || (arg == "--token-url")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid token url option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            token_url = argv[i + 1];
+        } else if ((arg == "-T") || (arg == "--token-cache")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid token cache option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            token_cache = argv[i + 1];
+        } else if ((arg == "-r") || (arg == "--report")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid report option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            report_file = argv[i + 1];
+        } else if ((arg == "-R") || (arg == "--rate")) {
+            if (i + 1 >= argc || atof(argv[i + 1]) < 0) {
+                std::cout << "Invalid rate option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            rate = atof(argv[i + 1]);
+        } else if ((arg == "-g") || (arg == "--group-column")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0 ||
+                atoi(argv[i + 1]) > 3) {
+                std::cout << "Invalid group column option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            group_column = atoi(argv[i + 1]);
+        } else if ((arg == "-G") || (arg == "--group-rate")) {
+            if (i + 1 >= argc ||
+                !ParseGroupRates(argv[i + 1], &group_rate, &group_rates)) {
+                std::cout << "Invalid group rate option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+        } else if ((arg == "-y") || (arg == "--retry-policy")) {
+            if (i + 1 >= argc || !retry_policy.Load(argv[i + 1])) {
+                std::cout << "Invalid retry policy option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+        } else if ((arg == "-k") || (arg == "--connect-timeout")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+                std::cout << "Invalid connect timeout option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            connect_timeout = std::chrono::milliseconds(atoi(argv[i + 1]));
+        } else if ((arg == "-o") || (arg == "--timeout")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+                std::cout << "Invalid timeout option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            request_timeout = std::chrono::milliseconds(atoi(argv[i + 1]));
+        } else if ((arg == "-H") || (arg == "--hedge")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid hedge option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            hedging = (atoi(argv[i + 1]) != 0);
+        } else if ((arg == "-b") || (arg == "--circuit-breaker")) {
+            if (i + 1 >= argc || atof(argv[i + 1]) < 0 ||
+                atof(argv[i + 1]) > 100) {
+                std::cout << "Invalid circuit breaker option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            breaker_ratio = atof(argv[i + 1]) / 100;
+        } else if ((arg == "-B") || (arg == "--breaker-open")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                std::cout << "Invalid breaker open option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            breaker_open = std::chrono::milliseconds(atoi(argv[i + 1]));
         }
     }
 
@@ -97,52 +366,84 @@ int main(int argc, char* argv[]) {
 
     std::unique_ptr<NetworkUpdater> nwup;
     try {
-        nwup =
-            std::make_unique<NetworkUpdater>(host_file, json_config, uri, port);
+        nwup = std::make_unique<NetworkUpdater>(host_file, json_config, uri,
+                                                port, stream_hosts,
+                                                group_column);
     } catch (std::invalid_argument const& e) {
         std::cout << e.what() << std::endl;
         return -1;
     }
 
-    for (const auto& mac : nwup->GetMacList()) {
-        uint32_t status_code = 0;
-        NetworkUpdater::UpdaterErr status =
-            nwup->SendRequest(mac, &status_code);
-        if (status == NetworkUpdater::UpdaterErr::Fail) {
-            if (fast_exit) {
-                std::cout << "Unable to send request for the host with mac "
-                          << mac.c_str() << std::endl;
-                return -1;
-            } else {
-                output_file << "Unable to send request for the host with mac "
-                            << mac.c_str() << std::endl;
-            }
-        }
+    // every worker keeps its connection between hosts, unless told otherwise
+    if (!pool_size_set) {
+        pool_size = std::max<size_t>(pool_size, concurrency);
+    }
+    nwup->SetConnectionPool(pool_size, idle_timeout);
+    if (nwup->SetHttp2(http2, max_streams) ==
+        NetworkUpdater::UpdaterErr::Fail) {
+        std::cout << "HTTP/2 needs libcurl 8.0.0 or later with nghttp2!"
+                  << std::endl;
+        return -1;
+    }
+    nwup->SetUniqueClientIds(unique_ids);
+    nwup->SetTimeouts(connect_timeout, request_timeout);
+    nwup->GetCircuitBreaker().Configure(breaker_ratio, breaker_open);
+    if (token_url != nullptr &&
+        nwup->SetTokenEndpoint(token_url, token_cache) ==
+            NetworkUpdater::UpdaterErr::Fail) {
+        std::cout << "Invalid token url!" << std::endl;
+        return -1;
+    }
+    if (nwup->RequestToken() == NetworkUpdater::UpdaterErr::Fail) {
+        std::cout << "Unable to get authentication token" << std::endl;
+        return -1;
+    }
 
-        if (status == NetworkUpdater::UpdaterErr::Retry) {
-            uint32_t retry_iteration = 1;  // first call already happened
-            while (retry_iteration <= NetworkUpdater::kTokenRetryCount &&
-                   status == NetworkUpdater::UpdaterErr::Retry) {
-                output_file << "Retrying to send request after getting token "
-                            << "for host mac: " << mac.c_str() << std::endl;
-                retry_iteration++;
-                status = nwup->SendRequest(mac, &status_code);
-            }
-
-            if (status != NetworkUpdater::UpdaterErr::Ok) {
-                if (fast_exit) {
-                    std::cout << "Unable to send request for the host with mac "
-                              << mac.c_str() << std::endl;
-                    return -1;
-                } else {
-                    output_file
-                        << "Unable to send request for the host with mac "
-                        << mac.c_str() << std::endl;
-                }
-            }
-        }
+    UpdateDispatcher dispatcher(nwup.get(), &output_file, concurrency,
+                                fast_exit, mode);
+    dispatcher.SetAdaptiveConcurrency(adaptive);
+    dispatcher.SetRetryPolicy(retry_policy);
+    dispatcher.SetHedging(hedging);
+    if (rate > 0 || group_rate > 0 || !group_rates.empty()) {
+        dispatcher.SetRateLimit(rate, group_rate, group_rates);
+    }
+    RequestStats& request_stats = nwup->GetRequestStats();
+    request_stats.Start();
+    NetworkUpdater::UpdaterErr result = dispatcher.Run();
+    request_stats.Stop();
+
+    // an aborted run is the one whose timings matter most
+    request_stats.PrintSummary(&std::cout);
+    if (dispatcher.GetLimiter() != nullptr) {
+        std::cout << "Adaptive concurrency limit: "
+                  << dispatcher.GetLimiter()->GetLimit() << std::endl;
+    }
+    const CircuitBreaker& breaker = nwup->GetCircuitBreaker();
+    if (breaker.GetTripCount() > 0) {
+        std::cout << "Circuit breaker opened " << breaker.GetTripCount()
+                  << " times, requests failed without being sent: "
+                  << breaker.GetRejectedCount() << std::endl;
+    }
+    if (report_file != nullptr && !request_stats.WriteJson(report_file)) {
+        std::cout << "WARNING: Unable to write the report file" << std::endl;
+    }
+    // the hosts to fix in the file, whether the run went through or not
+    for (const auto& rejected : nwup->GetRejectedHosts()) {
+        output_file << "Rejected invalid mac address \"" << rejected.text
+                    << "\" at line " << rejected.line_number << std::endl;
+    }
+    if (result == NetworkUpdater::UpdaterErr::Fail) {
+        return -1;
+    }
+
+    if (nwup->GetDuplicateCount() > 0) {
+        std::cout << "Duplicate hosts removed: " << nwup->GetDuplicateCount()
+                  << std::endl;
     }
 
+    ConnectionPool::Stats stats = nwup->GetConnectionPool().GetStats();
+    std::cout << "Connections opened: " << stats.connections_opened
+              << ", reused: " << stats.connections_reused << std::endl;
     std::cout << "Done!" << std::endl;
 
     return 0;
@@ -0,0 +1,388 @@
+#include <curl/curl.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#include "../include/multi_transport.hpp"
+
+// The buffers of a slot are sized once and patched for every host. The
+// header list nodes point straight into them, curl only reads the list.
+struct MultiTransport::Slot {
+    CURL* handle{nullptr};
+    curl_slist headers[3];
+    std::string url;
+    std::string client_id_header;
+    std::string token_header;
+    uint64_t token_generation{0};
+    Job job;
+    bool spare{false};
+    std::chrono::steady_clock::time_point sent_at;
+    bool in_flight{false};
+    // set on both transfers of a job once it got a hedge
+    bool hedged{false};
+    // the other transfer of the job while both run
+    Slot* twin{nullptr};
+};
+
+constexpr int kPollTimeoutMs = 1000;
+
+constexpr uint64_t MultiTransport::kMinHedgeSamples;
+constexpr double MultiTransport::kHedgePercentile;
+constexpr size_t MultiTransport::kSlotsPerSpare;
+constexpr std::chrono::milliseconds MultiTransport::kTokenPollInterval;
+
+// only the status code of a reply is looked at
+static size_t DiscardResponse(char* /* data */, size_t size, size_t nmemb,
+                              void* /* userdata */) {
+    return size * nmemb;
+}
+
+MultiTransport::MultiTransport(NetworkUpdater* updater, uint32_t max_in_flight)
+    : updater_(updater) {
+    multi_ = curl_multi_init();
+    if (multi_ == nullptr) {
+        throw(std::runtime_error("Unable to initialize curl multi handle!"));
+    }
+
+    // the multi handle owns the connection cache shared by all the slots
+    ConnectionPool& pool = updater_->GetConnectionPool();
+    curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS,
+                      static_cast<long>(pool.GetPoolSize()));
+    idle_timeout_ = pool.GetIdleTimeout().count();
+    http_version_ = CURL_HTTP_VERSION_1_1;
+
+    if (updater_->IsHttp2()) {
+        // spread the transfers as streams over as few connections as possible
+        long max_streams = updater_->GetMaxStreamsPerConnection();
+        long max_connections =
+            (std::max<long>(max_in_flight, 1) + max_streams - 1) / max_streams;
+        curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi_, CURLMOPT_MAX_CONCURRENT_STREAMS, max_streams);
+        curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS,
+                          max_connections);
+        http_version_ = updater_->IsHttps()
+                            ? CURL_HTTP_VERSION_2TLS
+                            : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+    }
+
+    // a token is never fetched on the event loop thread
+    updater_->GetTokenManager().StartBackgroundRefresh();
+
+    max_in_flight = std::max<uint32_t>(max_in_flight, 1);
+    slots_.reserve(max_in_flight);
+    free_slots_.reserve(max_in_flight);
+    for (uint32_t i = 0; i < max_in_flight; i++) {
+        free_slots_.push_back(AddSlot());
+    }
+}
+
+MultiTransport::Slot* MultiTransport::AddSlot() {
+    auto slot = std::make_unique<Slot>();
+    slot->handle = curl_easy_init();
+    if (slot->handle == nullptr) {
+        throw(std::runtime_error("Unable to initialize curl handle!"));
+    }
+    InitSlot(slot.get());
+
+    slots_.push_back(std::move(slot));
+    return slots_.back().get();
+}
+
+void MultiTransport::FreeSlot(Slot* slot) {
+    slot->in_flight = false;
+    if (slot->spare) {
+        spare_slots_.push_back(slot);
+    } else {
+        free_slots_.push_back(slot);
+    }
+}
+
+MultiTransport::~MultiTransport() {
+    for (auto& slot : slots_) {
+        curl_multi_remove_handle(multi_, slot->handle);
+        curl_easy_cleanup(slot->handle);
+    }
+
+    curl_multi_cleanup(multi_);
+}
+
+void MultiTransport::Run(const NextJob& next_job, const JobDone& job_done) {
+    while (true) {
+        // top up the free slots, finished transfers may have queued retries
+        wake_at_ = std::chrono::steady_clock::time_point();
+        ResumeParked(job_done);
+        while (!free_slots_.empty()) {
+            Slot* slot = free_slots_.back();
+            if (!next_job(&slot->job)) {
+                break;
+            }
+
+            free_slots_.pop_back();
+            StartTransfer(slot);
+        }
+        if (hedging_) {
+            StartHedges();
+        }
+
+        bool waking = wake_at_ != std::chrono::steady_clock::time_point();
+        if (free_slots_.size() + spare_slots_.size() == slots_.size() &&
+            parked_.empty() && !waking) {
+            return;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi_, &running);
+
+        int pending = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi_, &pending)) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
+            Slot* slot = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &slot);
+            FinishTransfer(slot, msg->data.result, job_done);
+        }
+
+        // curl_multi_poll also sleeps when no transfer is running. Rounded
+        // down, at high rates the wait is mostly under a millisecond and the
+        // loop spins rather than let the pacing fall behind.
+        int timeout_ms = kPollTimeoutMs;
+        if (waking) {
+            auto wait = std::chrono::floor<std::chrono::milliseconds>(
+                wake_at_ - std::chrono::steady_clock::now());
+            timeout_ms = static_cast<int>(std::min<int64_t>(
+                std::max<int64_t>(wait.count(), 0), timeout_ms));
+        }
+        if (running > 0 || (waking && timeout_ms > 0)) {
+            curl_multi_poll(multi_, nullptr, 0, timeout_ms, nullptr);
+        }
+    }
+}
+
+void MultiTransport::WakeAt(std::chrono::steady_clock::time_point when) {
+    if (wake_at_ == std::chrono::steady_clock::time_point() ||
+        when < wake_at_) {
+        wake_at_ = when;
+    }
+}
+
+void MultiTransport::SetHedging(bool enabled) {
+    hedging_ = enabled;
+    if (!hedging_ || !spare_slots_.empty()) {
+        return;
+    }
+
+    // a run stuck with every slot on a hung host still has room for hedges
+    size_t spares = std::max<size_t>(slots_.size() / kSlotsPerSpare, 1);
+    for (size_t i = 0; i < spares; i++) {
+        Slot* slot = AddSlot();
+        slot->spare = true;
+        spare_slots_.push_back(slot);
+    }
+}
+
+void MultiTransport::StartHedges() {
+    // no duplicates for a server that is failing, nor without a token to
+    // send them with
+    auto now = std::chrono::steady_clock::now();
+    if (latencies_.GetCount() < kMinHedgeSamples ||
+        updater_->GetCircuitBreaker().GetState() !=
+            CircuitBreaker::State::Closed ||
+        now >= updater_->GetTokenManager().Peek().expires_at) {
+        return;
+    }
+
+    auto delay =
+        std::chrono::microseconds(latencies_.GetPercentile(kHedgePercentile));
+    // the free regular slots may be held back by the rate or concurrency
+    // limits, a hedge must not get around them
+    for (auto& slot : slots_) {
+        if (spare_slots_.empty()) {
+            break;
+        }
+        if (!slot->in_flight || slot->hedged) {
+            continue;
+        }
+
+        auto hedge_at = slot->sent_at + delay;
+        if (hedge_at > now) {
+            WakeAt(hedge_at);
+            continue;
+        }
+
+        Slot* hedge = spare_slots_.back();
+        spare_slots_.pop_back();
+        hedge->job = slot->job;
+        StartTransfer(hedge, slot.get());
+        slot->hedged = true;
+        hedge->hedged = true;
+        slot->twin = hedge;
+        hedge->twin = slot.get();
+        updater_->GetRequestStats().CountHedge();
+    }
+}
+
+void MultiTransport::InitSlot(Slot* slot) {
+    const RequestTemplate& request = updater_->GetRequestTemplate();
+    request.InitUrl(&slot->url);
+    request.InitClientIdHeader(&slot->client_id_header);
+    const TokenManager::Token& token = updater_->GetTokenManager().Peek();
+    request.FormatTokenHeader(token.value, &slot->token_header);
+    slot->token_generation = token.generation;
+
+    slot->headers[0].data = const_cast<char*>(request.GetContentTypeHeader());
+    slot->headers[0].next = &slot->headers[1];
+    slot->headers[1].next = &slot->headers[2];
+    slot->headers[2].next = nullptr;
+
+    // options shared by every transfer of the slot stay set on the handle
+    CURL* handle = slot->handle;
+    // every slot points at the same mapped payload, curl does not copy it
+    const PayloadBuffer& body = updater_->GetPayload();
+    curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, body.data());
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE,
+                     static_cast<curl_off_t>(body.size()));
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, &slot->headers[0]);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, DiscardResponse);
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, slot);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, idle_timeout_);
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, http_version_);
+    // wait for a stream on an existing connection rather than open a new one
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, updater_->IsHttp2() ? 1L : 0L);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<long>(updater_->GetConnectTimeout().count()));
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS,
+                     static_cast<long>(updater_->GetRequestTimeout().count()));
+}
+
+void MultiTransport::StartTransfer(Slot* slot, const Slot* hedged) {
+    TokenManager& tokens = updater_->GetTokenManager();
+    const TokenManager::Token& token = tokens.Peek();
+    // StartHedges already checked the token of a hedge
+    if (hedged == nullptr &&
+        std::chrono::steady_clock::now() >= token.expires_at) {
+        parked_.emplace(token.generation, Parked{slot->job, slot});
+        tokens.PollRefresh(token.generation);
+        return;
+    }
+
+    CURL* handle = slot->handle;
+    const RequestTemplate& request = updater_->GetRequestTemplate();
+
+    request.PatchUrl(slot->job.mac, &slot->url);
+    if (hedged != nullptr) {
+        // same length, the buffer is not reallocated
+        slot->client_id_header = hedged->client_id_header;
+    } else {
+        request.PatchClientIdHeader(updater_->GenerateHttpId(),
+                                    &slot->client_id_header);
+    }
+    if (slot->token_generation != token.generation) {
+        slot->token_generation = token.generation;
+        request.FormatTokenHeader(token.value, &slot->token_header);
+    }
+    slot->headers[1].data = &slot->client_id_header[0];
+    slot->headers[2].data = &slot->token_header[0];
+
+    curl_easy_setopt(handle, CURLOPT_URL, slot->url.c_str());
+    slot->sent_at = std::chrono::steady_clock::now();
+    slot->in_flight = true;
+    slot->hedged = false;
+    slot->twin = nullptr;
+    curl_multi_add_handle(multi_, handle);
+}
+
+void MultiTransport::FinishTransfer(Slot* slot, int curl_code,
+                                    const JobDone& job_done) {
+    long status_code = 0;
+    if (curl_code == CURLE_OK) {
+        curl_easy_getinfo(slot->handle, CURLINFO_RESPONSE_CODE, &status_code);
+
+        long connects = 0;
+        curl_easy_getinfo(slot->handle, CURLINFO_NUM_CONNECTS, &connects);
+        updater_->GetConnectionPool().CountConnection(connects == 0);
+    }
+    updater_->GetRequestStats().RecordTransfer(status_code, slot->handle);
+
+    curl_multi_remove_handle(multi_, slot->handle);
+    FreeSlot(slot);
+    // the timed out and failed transfers are the tail the hedges are for,
+    // they count too, as long as the timeout at most
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - slot->sent_at);
+    std::chrono::microseconds timeout = updater_->GetRequestTimeout();
+    if (curl_code != CURLE_OK && timeout.count() > 0) {
+        elapsed = std::min(elapsed, timeout);
+    }
+    latencies_.Record(elapsed.count());
+
+    Slot* twin = slot->twin;
+    if (twin != nullptr) {
+        slot->twin = nullptr;
+        twin->twin = nullptr;
+        // the other transfer may still get a reply
+        if (curl_code != CURLE_OK) {
+            return;
+        }
+
+        // first reply wins, the slower transfer is dropped. Its pending
+        // done message, if any, goes with it.
+        curl_multi_remove_handle(multi_, twin->handle);
+        FreeSlot(twin);
+        // the hedge is the one sent last
+        if (slot->sent_at > twin->sent_at) {
+            updater_->GetRequestStats().CountHedgeWin();
+        }
+    }
+
+    // HandleResponse would fetch the next token on this thread, every
+    // other transfer would wait for it
+    if (status_code == NetworkUpdater::HttpError::AuthError) {
+        parked_.emplace(slot->token_generation, Parked{slot->job, nullptr});
+        updater_->GetTokenManager().PollRefresh(slot->token_generation);
+        return;
+    }
+
+    NetworkUpdater::UpdaterErr status =
+        updater_->HandleResponse(status_code, slot->token_generation);
+    job_done(slot->job, status, static_cast<uint32_t>(status_code));
+}
+
+void MultiTransport::ResumeParked(const JobDone& job_done) {
+    TokenManager& tokens = updater_->GetTokenManager();
+    auto parked = parked_.begin();
+    while (parked != parked_.end()) {
+        uint64_t generation = parked->first;
+        TokenManager::RefreshState state = tokens.PollRefresh(generation);
+        if (state == TokenManager::RefreshState::Pending) {
+            WakeAt(std::chrono::steady_clock::now() + kTokenPollInterval);
+            parked = parked_.upper_bound(generation);
+            continue;
+        }
+
+        // a job parked again goes under the generation of the new token
+        Parked resumed = parked->second;
+        parked = parked_.erase(parked);
+        if (state == TokenManager::RefreshState::Done) {
+            if (resumed.slot != nullptr) {
+                StartTransfer(resumed.slot);
+            } else {
+                job_done(resumed.job, NetworkUpdater::UpdaterErr::Retry,
+                         NetworkUpdater::HttpError::AuthError);
+            }
+            continue;
+        }
+
+        // what a 401 sent with the old token would have ended in
+        std::cout << "Unable to refresh the authentication token" << std::endl;
+        if (resumed.slot != nullptr) {
+            FreeSlot(resumed.slot);
+        }
+        job_done(resumed.job, NetworkUpdater::UpdaterErr::Fail,
+                 NetworkUpdater::HttpError::AuthError);
+    }
+}
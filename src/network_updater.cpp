@@ -1,18 +1,35 @@
 #include <algorithm>
-#include <fstream>
 #include <iostream>
-#include <random>
-#include <regex>
-#include <sstream>
 #include <stdexcept>
+#include <string_view>
 
 #include <cpr/cpr.h>
 #include "../include/json.hpp"
 #include "../include/network_updater.hpp"
 
+uint32_t NetworkUpdater::kTokenRetryCount = 3;
+
+struct NetworkUpdater::RequestBuffers::HeaderList {
+    curl_slist nodes[3];
+};
+
+NetworkUpdater::RequestBuffers::RequestBuffers()
+    : headers(std::make_unique<HeaderList>()) {}
+
+NetworkUpdater::RequestBuffers::~RequestBuffers() = default;
+
+// only the status code of a reply is looked at
+static size_t DiscardResponse(char* /* data */, size_t size, size_t nmemb,
+                              void* /* userdata */) {
+    return size * nmemb;
+}
+
 NetworkUpdater::NetworkUpdater(const char* hosts_fname, const char* json_fname,
-                               const char* uri, int port) {
-    if (ReadMacAddrList(hosts_fname) == NetworkUpdater::UpdaterErr::Fail) {
+                               const char* uri, int port, bool stream_hosts,
+                               size_t group_column)
+    : group_column_(group_column) {
+    if (ReadMacAddrList(hosts_fname, stream_hosts) ==
+        NetworkUpdater::UpdaterErr::Fail) {
         throw(std::invalid_argument(
             "Invalid hosts file name. Can not retrieve client mac addresses!"));
     }
@@ -21,37 +38,52 @@ NetworkUpdater::NetworkUpdater(const char* hosts_fname, const char* json_fname,
         throw(std::invalid_argument("Invalid json config file name!"));
     }
 
+    // url_ points into uri_, which lives as long as the updater
     uri_ = std::string(uri);
-    if (!IsUrlValid(uri_)) {
+    if (!ParsedUrl::Parse(uri_, &url_) || port < 0 || port > 65535) {
         throw(std::invalid_argument("Invalid destination address!"));
     }
 
+    // a port written in the url wins over the port option
     port_ = port;
-
-    // before sending the first request we need a token
-    RequestToken();
+    destination_ = url_.Join(static_cast<uint16_t>(port_));
+    if (!destination_.empty() && destination_.back() == '/') {
+        destination_.pop_back();
+    }
+    request_template_ = RequestTemplate(destination_ + "/profiles/clientId:");
 }
 
 NetworkUpdater::UpdaterErr NetworkUpdater::ReadMacAddrList(
-    const char* hosts_fname) {
-    std::string line;
-    std::ifstream input_file(hosts_fname);
-    std::string result;
-
-    if (!input_file.is_open()) {
+    const char* hosts_fname, bool stream_hosts) {
+    auto reader = std::make_unique<MacListReader>();
+    if (!reader->Open(hosts_fname)) {
         return NetworkUpdater::UpdaterErr::Fail;
     }
 
-    while (std::getline(input_file, line)) {
-        if (line.find("mac") != std::string::npos) {
-            continue;
+    std::string_view mac_addr;
+    if (stream_hosts) {
+        // only make sure there is something to send, the dispatcher reads
+        // the rest of the file while the first requests are in flight
+        if (!reader->Next(&mac_addr)) {
+            throw(
+                std::runtime_error("No mac address found in the hosts file!"));
         }
 
-        std::stringstream line_stream(line);
-        if (getline(line_stream, result, ',')) {
-            result.erase(std::remove(result.begin(), result.end(), '"'),
-                         result.end());
-            mac_list_.push_back(result);
+        reader->Rewind();
+        mac_reader_ = std::move(reader);
+        return NetworkUpdater::UpdaterErr::Ok;
+    }
+
+    // every row is validated and normalized, the invalid ones are reported
+    MacAddress mac;
+    while (reader->Next(&mac_addr)) {
+        if (!MacAddress::Parse(mac_addr, &mac)) {
+            RejectHost(reader->GetLineNumber(), mac_addr);
+        } else if (group_column_ > 0) {
+            mac_list_.push_back(mac,
+                                GetHostGroup(reader->GetColumn(group_column_)));
+        } else {
+            mac_list_.push_back(mac);
         }
     }
 
@@ -59,63 +91,252 @@ NetworkUpdater::UpdaterErr NetworkUpdater::ReadMacAddrList(
         throw(std::runtime_error("No mac address found in the hosts file!"));
     }
 
+    // a host listed twice would get a second PUT that only ends in a 409
+    duplicate_hosts_ = mac_list_.RemoveDuplicates();
+
     return NetworkUpdater::UpdaterErr::Ok;
 }
 
 NetworkUpdater::UpdaterErr NetworkUpdater::ReadJsonConfig(
     const char* json_fname) {
-    std::ifstream input_file(json_fname);
-    std::string result;
-
-    if (!input_file.is_open()) {
+    // mapped once, every request references the same bytes
+    if (!payload_.Load(json_fname)) {
         return NetworkUpdater::UpdaterErr::Fail;
     }
 
-    std::stringstream str_stream;
-    str_stream << input_file.rdbuf();
-    json_config_ = str_stream.str();
-
     return NetworkUpdater::UpdaterErr::Ok;
 }
 
 NetworkUpdater::UpdaterErr NetworkUpdater::SendRequest(
     const std::string& mac_addr, uint32_t* status_code) {
-    std::string uri;
-    std::string port_string;
-    if (port_) {
-        port_string = std::string(":") + std::to_string(port_);
+    RequestBuffers buffers;
+    InitRequestBuffers(&buffers);
+    request_template_.PatchUrl(mac_addr, &buffers.url);
+    return PutProfile(&buffers, status_code);
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::SendRequest(const MacAddress& mac,
+                                                       uint32_t* status_code) {
+    RequestBuffers buffers;
+    return SendRequest(mac, &buffers, status_code);
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::SendRequest(
+    const MacAddress& mac, RequestBuffers* buffers, uint32_t* status_code) {
+    if (buffers->url.empty()) {
+        InitRequestBuffers(buffers);
+    }
+    request_template_.PatchUrl(mac, &buffers->url);
+    return PutProfile(buffers, status_code);
+}
+
+void NetworkUpdater::InitRequestBuffers(RequestBuffers* buffers) {
+    request_template_.InitUrl(&buffers->url);
+    request_template_.InitClientIdHeader(&buffers->client_id_header);
+    const TokenManager::Token& token = token_manager_.Current();
+    request_template_.FormatTokenHeader(token.value, &buffers->token_header);
+    buffers->token_generation = token.generation;
+
+    curl_slist* nodes = buffers->headers->nodes;
+    nodes[0].data = const_cast<char*>(request_template_.GetContentTypeHeader());
+    nodes[0].next = &nodes[1];
+    nodes[1].next = &nodes[2];
+    nodes[2].next = nullptr;
+}
+
+void NetworkUpdater::InitSession(void* curl_handle) {
+    CURL* handle = curl_handle;
+    // every session points at the same mapped payload, curl does not copy
+    // it and neither does cpr, its body is never set
+    curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, payload_.data());
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE,
+                     static_cast<curl_off_t>(payload_.size()));
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, DiscardResponse);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    if (http2_) {
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION,
+                         IsHttps() ? CURL_HTTP_VERSION_2TLS
+                                   : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+    }
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::PutProfile(RequestBuffers* buffers,
+                                                      uint32_t* status_code) {
+    request_template_.PatchClientIdHeader(GenerateHttpId(),
+                                          &buffers->client_id_header);
+    const TokenManager::Token& token = token_manager_.Current();
+    if (buffers->token_generation != token.generation) {
+        buffers->token_generation = token.generation;
+        request_template_.FormatTokenHeader(token.value,
+                                            &buffers->token_header);
+    }
+    curl_slist* nodes = buffers->headers->nodes;
+    nodes[1].data = &buffers->client_id_header[0];
+    nodes[2].data = &buffers->token_header[0];
+
+    // a pooled session keeps its connection alive between hosts
+    bool fresh_session = false;
+    std::unique_ptr<cpr::Session> session =
+        connection_pool_.Acquire(destination_, &fresh_session);
+    CURL* handle = session->GetCurlHolder()->handle;
+    if (fresh_session) {
+        InitSession(handle);
     }
+    // the header list and the url belong to this worker, the session may
+    // have sent the updates of another one
+    curl_easy_setopt(handle, CURLOPT_URL, buffers->url.c_str());
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, &nodes[0]);
+    // a hung server node fails the host instead of stalling its worker
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<long>(connect_timeout_.count()));
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS,
+                     static_cast<long>(request_timeout_.count()));
 
-    uri = uri_ + port_string + std::string("/profiles/clientId:") + mac_addr;
+    long response_code = 0;
+    if (curl_easy_perform(handle) == CURLE_OK) {
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
+    }
+    *status_code = static_cast<uint32_t>(response_code);
+    request_stats_.RecordTransfer(response_code, handle);
+
+    // a failed transfer may leave a broken connection behind, don't pool it
+    if (response_code != 0) {
+        long connects = 0;
+        curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+        connection_pool_.CountConnection(connects == 0);
+        connection_pool_.Release(destination_, std::move(session));
+    }
+
+    return HandleResponse(response_code, buffers->token_generation);
+}
+
+RequestTemplate const& NetworkUpdater::GetRequestTemplate() const {
+    return request_template_;
+}
+
+size_t NetworkUpdater::GetGroupColumn() const {
+    return group_column_;
+}
+
+uint32_t NetworkUpdater::GetHostGroup(std::string_view name) {
+    std::lock_guard<std::mutex> lock(groups_mutex_);
+    auto group = group_ids_.find(name);
+    if (group != group_ids_.end()) {
+        return group->second;
+    }
+
+    uint32_t id = static_cast<uint32_t>(group_names_.size());
+    group_names_.emplace_back(name);
+    group_ids_.emplace(group_names_.back(), id);
+    return id;
+}
+
+std::string NetworkUpdater::GetGroupName(uint32_t group) const {
+    std::lock_guard<std::mutex> lock(groups_mutex_);
+    return group < group_names_.size() ? group_names_[group] : std::string();
+}
 
-    std::string client_id = std::to_string(GenerateHttpId());
-    cpr::Response r =
-        cpr::Put(cpr::Url{uri.c_str()}, cpr::Body{json_config_.c_str()},
-                 cpr::Header{{"Content-Type", "application/json"},
-                             {"x-client-id", client_id.c_str()},
-                             {"x-authentication-token", token_.c_str()}});
-    *status_code = r.status_code;
+size_t NetworkUpdater::GetGroupCount() const {
+    std::lock_guard<std::mutex> lock(groups_mutex_);
+    return group_names_.size();
+}
+
+void NetworkUpdater::SetConnectionPool(size_t pool_size,
+                                       std::chrono::seconds idle_timeout) {
+    connection_pool_.Configure(pool_size, idle_timeout);
+}
+
+ConnectionPool& NetworkUpdater::GetConnectionPool() {
+    return connection_pool_;
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::SetHttp2(
+    bool enabled, uint32_t max_streams_per_connection) {
+    if (enabled) {
+        curl_version_info_data const* curl = curl_version_info(CURLVERSION_NOW);
+        // 7.88 breaks the framing layer on the second stream of a connection
+        if (!(curl->features & CURL_VERSION_HTTP2) ||
+            curl->version_num < kMinHttp2CurlVersion) {
+            return UpdaterErr::Fail;
+        }
+    }
+    http2_ = enabled;
+    max_streams_per_connection_ =
+        std::max<uint32_t>(max_streams_per_connection, 1);
+    return UpdaterErr::Ok;
+}
+
+void NetworkUpdater::SetUniqueClientIds(bool unique) {
+    client_ids_.SetUnique(unique);
+}
+
+bool NetworkUpdater::HasUniqueClientIds() const {
+    return client_ids_.IsUnique();
+}
+
+bool NetworkUpdater::IsHttp2() const {
+    return http2_;
+}
 
-    switch (r.status_code) {
+bool NetworkUpdater::IsHttps() const {
+    return url_.IsHttps();
+}
+
+uint32_t NetworkUpdater::GetMaxStreamsPerConnection() const {
+    return max_streams_per_connection_;
+}
+
+void NetworkUpdater::SetTimeouts(std::chrono::milliseconds connect_timeout,
+                                 std::chrono::milliseconds request_timeout) {
+    connect_timeout_ = connect_timeout;
+    request_timeout_ = request_timeout;
+}
+
+std::chrono::milliseconds NetworkUpdater::GetConnectTimeout() const {
+    return connect_timeout_;
+}
+
+std::chrono::milliseconds NetworkUpdater::GetRequestTimeout() const {
+    return request_timeout_;
+}
+
+RequestStats& NetworkUpdater::GetRequestStats() {
+    return request_stats_;
+}
+
+CircuitBreaker& NetworkUpdater::GetCircuitBreaker() {
+    return circuit_breaker_;
+}
+
+PayloadBuffer const& NetworkUpdater::GetPayload() const {
+    return payload_;
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::HandleResponse(
+    long status_code, uint64_t token_generation) {
+    switch (status_code) {
         case NetworkUpdater::HttpError::Success:
             return NetworkUpdater::UpdaterErr::Ok;
 
         // either the token is not right or it expired
         case NetworkUpdater::HttpError::AuthError:
-            RequestToken();
+            if (!token_manager_.Refresh(token_generation)) {
+                std::cout << "Unable to refresh the authentication token"
+                          << std::endl;
+                return NetworkUpdater::UpdaterErr::Fail;
+            }
             return NetworkUpdater::UpdaterErr::Retry;
 
         case NetworkUpdater::HttpError::InvalidProfileOrClient:
         case NetworkUpdater::HttpError::Conflict:
-        case NetworkUpdater::HttpError::InternalError: {
-            auto json = nlohmann::json::parse(r.text);
-            // std::cout << json.dump(4) << json["message"] << std::endl;
-            // std::cout << json["message"] << std::endl;
+        // the body may not even be json, a proxy in front of the server
+        // answers with its own page
+        case NetworkUpdater::HttpError::InternalError:
             return NetworkUpdater::UpdaterErr::Fail;
-        }
 
         default:
-            std::cout << "Server is unreachable. Code: " << r.status_code
+            std::cout << "Server is unreachable. Code: " << status_code
                       << std::endl;
             break;
     }
@@ -123,38 +344,115 @@ NetworkUpdater::UpdaterErr NetworkUpdater::SendRequest(
     return NetworkUpdater::UpdaterErr::Fail;
 }
 
+std::string NetworkUpdater::GetToken() {
+    return token_manager_.Current().value;
+}
+
+TokenManager& NetworkUpdater::GetTokenManager() {
+    return token_manager_;
+}
+
 uint32_t NetworkUpdater::GenerateHttpId() {
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_int_distribution<int> dist(1, kMaxClientId);
-    return dist(mt);
-}
-
-void NetworkUpdater::RequestToken() {
-#if VALID_TOKEN_SCENARIO
-#if CPR_LIBCURL_VERSION_NUM >= 0x073D00
-    // Perform the request like usually:
-    cpr::Response r = cpr::Get(cpr::Url{"http://www.httpbin.org/bearer"},
-                               cpr::Bearer{"ACCESS_TOKEN"});
-#else
-    // Manually add the Authorization header:
-    cpr::Response r = cpr::Get(cpr::Url{"http://www.httpbin.org/bearer"},
-                               cpr::HeaderAuthorization);
-#endif
-    auto json = nlohmann::json::parse(r.text);
-    if (!json["token"]) {
-        throw(std::runtime_error("Unable to get authentication token"))
-    }
-    token_ = std::string(json["token"]);
-#endif
-    token_ = std::string("123456789abcdef123456789abcdef");
-}
-
-std::vector<std::string> const& NetworkUpdater::GetMacList() const {
+    return client_ids_.Next();
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::SetTokenEndpoint(
+    const std::string& token_url, const std::string& cache_fname) {
+    ParsedUrl url;
+    if (!ParsedUrl::Parse(token_url, &url)) {
+        return NetworkUpdater::UpdaterErr::Fail;
+    }
+
+    token_url_ = token_url;
+    if (!cache_fname.empty()) {
+        token_cache_ = std::make_unique<TokenCache>(cache_fname);
+    }
+    token_manager_.StartBackgroundRefresh();
+    return NetworkUpdater::UpdaterErr::Ok;
+}
+
+NetworkUpdater::UpdaterErr NetworkUpdater::RequestToken() {
+    // the first reader waits for the first token to be fetched
+    if (token_manager_.Current().generation == 0) {
+        return NetworkUpdater::UpdaterErr::Fail;
+    }
+
+    return NetworkUpdater::UpdaterErr::Ok;
+}
+
+// Called by the token manager, never twice at the same time
+bool NetworkUpdater::FetchToken(std::string* token,
+                                std::chrono::seconds* expires_in) {
+    if (token_url_.empty()) {
+        *token = std::string(kTestToken);
+        return true;
+    }
+
+    if (token_cache_ && !token_cache_read_) {
+        token_cache_read_ = true;
+        if (token_cache_->Load(token_url_, token_manager_.GetRefreshMargin(),
+                               token, expires_in)) {
+            return true;
+        }
+    }
+
+    cpr::Session session;
+    session.SetUrl(cpr::Url{token_url_});
+    session.SetHeader(cpr::Header{{"Accept", "application/json"}});
+    session.SetTimeout(cpr::Timeout{kTokenTimeout});
+    cpr::Response r = session.Post();
+    if (r.status_code != NetworkUpdater::HttpError::Success) {
+        std::cout << "Token endpoint replied with code: " << r.status_code
+                  << std::endl;
+        return false;
+    }
+
+    // the OAuth2 access_token or a plain token field
+    auto json = nlohmann::json::parse(r.text, nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        return false;
+    }
+    if (json["access_token"].is_string()) {
+        *token = json["access_token"];
+    } else if (json["token"].is_string()) {
+        *token = json["token"];
+    } else {
+        return false;
+    }
+    if (json["expires_in"].is_number_integer()) {
+        *expires_in = std::chrono::seconds(json["expires_in"].get<int64_t>());
+    }
+
+    if (token_cache_ && !token_cache_->Store(token_url_, *token, *expires_in)) {
+        std::cout << "WARNING: Unable to cache the authentication token"
+                  << std::endl;
+    }
+    return true;
+}
+
+MacList const& NetworkUpdater::GetMacList() const {
     return mac_list_;
 }
 
-bool NetworkUpdater::IsUrlValid(const std::string& url) {
-    std::regex url_regex(R"(^https?://[0-9a-z\.-]+(:[1-9][0-9]*)?(/[^\s]*)*$)");
-    return std::regex_match(url, url_regex);
-}
\ No newline at end of file
+MacListReader* NetworkUpdater::GetMacReader() {
+    return mac_reader_.get();
+}
+
+void NetworkUpdater::RejectHost(size_t line_number, std::string_view text) {
+    std::lock_guard<std::mutex> lock(rejects_mutex_);
+    rejected_hosts_.push_back({line_number, std::string(text)});
+}
+
+void NetworkUpdater::CountDuplicateHost() {
+    duplicate_hosts_++;
+}
+
+size_t NetworkUpdater::GetDuplicateCount() const {
+    return duplicate_hosts_;
+}
+
+std::vector<NetworkUpdater::RejectedHost> NetworkUpdater::GetRejectedHosts()
+    const {
+    std::lock_guard<std::mutex> lock(rejects_mutex_);
+    return rejected_hosts_;
+}
@@ -0,0 +1,92 @@
+#include "../include/parsed_url.hpp"
+
+namespace {
+
+constexpr std::string_view kSchemeSeparator = "://";
+constexpr uint32_t kMaxPort = 65535;
+
+bool IsHostChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' ||
+           c == '-';
+}
+
+bool IsSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+}  // namespace
+
+bool ParsedUrl::Parse(std::string_view text, ParsedUrl* url) {
+    size_t pos = text.find(kSchemeSeparator);
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+
+    std::string_view scheme = text.substr(0, pos);
+    if (scheme != "http" && scheme != "https") {
+        return false;
+    }
+    pos += kSchemeSeparator.size();
+
+    size_t host_start = pos;
+    while (pos < text.size() && IsHostChar(text[pos])) {
+        pos++;
+    }
+    if (pos == host_start) {
+        return false;
+    }
+    std::string_view host = text.substr(host_start, pos - host_start);
+
+    uint32_t port = 0;
+    if (pos < text.size() && text[pos] == ':') {
+        pos++;
+        // no leading zero and at most five digits
+        if (pos >= text.size() || text[pos] < '1' || text[pos] > '9') {
+            return false;
+        }
+        size_t port_start = pos;
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+            if (pos - port_start == 5) {
+                return false;
+            }
+            port = port * 10 + (text[pos] - '0');
+            pos++;
+        }
+        if (port > kMaxPort) {
+            return false;
+        }
+    }
+
+    std::string_view path = text.substr(pos);
+    if (!path.empty() && path[0] != '/') {
+        return false;
+    }
+    for (char c : path) {
+        if (IsSpace(c)) {
+            return false;
+        }
+    }
+
+    url->scheme = scheme;
+    url->host = host;
+    url->port = static_cast<uint16_t>(port);
+    url->path = path;
+    return true;
+}
+
+std::string ParsedUrl::Join(uint16_t default_port) const {
+    uint16_t effective_port = port != 0 ? port : default_port;
+
+    std::string text;
+    text.reserve(scheme.size() + kSchemeSeparator.size() + host.size() + 6 +
+                 path.size());
+    text.append(scheme);
+    text.append(kSchemeSeparator);
+    text.append(host);
+    if (effective_port != 0) {
+        text.push_back(':');
+        text.append(std::to_string(effective_port));
+    }
+    text.append(path);
+    return text;
+}
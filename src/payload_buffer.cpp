@@ -0,0 +1,84 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/payload_buffer.hpp"
+
+constexpr size_t kReadChunkSize = 64 * 1024;
+
+PayloadBuffer::~PayloadBuffer() {
+    Release();
+}
+
+bool PayloadBuffer::Load(const char* fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        close(fd);
+        return false;
+    }
+
+    Release();
+
+    // a pipe or /dev/stdin has no size to map, it is read into memory
+    if (!S_ISREG(file_stat.st_mode)) {
+        bool read_all = ReadAll(fd);
+        close(fd);
+        return read_all;
+    }
+
+    // an empty config can not be mapped, it is sent as an empty body
+    if (file_stat.st_size > 0) {
+        void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ,
+                             MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+
+        mapping_ = mapping;
+        data_ = static_cast<const char*>(mapping);
+        size_ = file_stat.st_size;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    return true;
+}
+
+bool PayloadBuffer::ReadAll(int fd) {
+    char buffer[kReadChunkSize];
+    while (true) {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            copy_.append(buffer, bytes);
+        } else if (bytes == 0) {
+            break;
+        } else if (errno != EINTR) {
+            copy_.clear();
+            return false;
+        }
+    }
+
+    data_ = copy_.data();
+    size_ = copy_.size();
+    return true;
+}
+
+void PayloadBuffer::Release() {
+    if (mapping_ != nullptr) {
+        munmap(mapping_, size_);
+    }
+
+    mapping_ = nullptr;
+    copy_.clear();
+    copy_.shrink_to_fit();
+    data_ = "";
+    size_ = 0;
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <thread>
+
+#include "../include/rate_limiter.hpp"
+
+constexpr uint32_t RateLimiter::kFirstBlockBits;
+constexpr uint32_t RateLimiter::kBlockCount;
+constexpr std::chrono::milliseconds RateLimiter::kBurstWindow;
+
+RateLimiter::RateLimiter(double global_rate, GroupRate group_rate)
+    : global_(MakeBucket(global_rate)), group_rate_(std::move(group_rate)) {
+    for (auto& block : blocks_) {
+        block.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+RateLimiter::~RateLimiter() {
+    for (uint32_t i = 0; i < kBlockCount; i++) {
+        std::atomic<TokenBucket*>* block =
+            blocks_[i].load(std::memory_order_relaxed);
+        if (block == nullptr) {
+            continue;
+        }
+
+        size_t size = size_t{1} << (kFirstBlockBits + i);
+        for (size_t j = 0; j < size; j++) {
+            TokenBucket* bucket = block[j].load(std::memory_order_relaxed);
+            if (bucket != &unlimited_) {
+                delete bucket;
+            }
+        }
+        delete[] block;
+    }
+}
+
+std::unique_ptr<TokenBucket> RateLimiter::MakeBucket(double rate) {
+    if (rate <= 0) {
+        return nullptr;
+    }
+
+    double burst = rate * std::chrono::duration<double>(kBurstWindow).count();
+    return std::make_unique<TokenBucket>(rate, burst);
+}
+
+std::atomic<TokenBucket*>& RateLimiter::GetGroupSlot(uint32_t group) {
+    // offset by the size of the first block, the highest bit of the index
+    // is then the block and the bits under it the slot in the block
+    uint64_t index = uint64_t{group} + (uint64_t{1} << kFirstBlockBits);
+    uint32_t bits = 63 - __builtin_clzll(index);
+    std::atomic<std::atomic<TokenBucket*>*>& block =
+        blocks_[bits - kFirstBlockBits];
+    std::atomic<TokenBucket*>* slots = block.load(std::memory_order_acquire);
+    if (slots == nullptr) {
+        size_t size = size_t{1} << bits;
+        std::unique_ptr<std::atomic<TokenBucket*>[]> created(
+            new std::atomic<TokenBucket*>[size]);
+        for (size_t i = 0; i < size; i++) {
+            created[i].store(nullptr, std::memory_order_relaxed);
+        }
+        // the loser of a race drops its block
+        if (block.compare_exchange_strong(slots, created.get(),
+                                          std::memory_order_acq_rel)) {
+            slots = created.release();
+        }
+    }
+
+    return slots[index - (uint64_t{1} << bits)];
+}
+
+TokenBucket* RateLimiter::GetGroupBucket(uint32_t group) {
+    std::atomic<TokenBucket*>& slot = GetGroupSlot(group);
+    TokenBucket* bucket = slot.load(std::memory_order_acquire);
+    if (bucket != nullptr) {
+        return bucket;
+    }
+
+    // two threads may race to create it, the loser drops its copy
+    std::unique_ptr<TokenBucket> created = MakeBucket(group_rate_(group));
+    TokenBucket* fresh = created ? created.get() : &unlimited_;
+    if (!slot.compare_exchange_strong(bucket, fresh,
+                                      std::memory_order_acq_rel)) {
+        return bucket;
+    }
+    created.release();
+    return fresh;
+}
+
+RateLimiter::Clock::time_point RateLimiter::ReserveGroup(
+    uint32_t group, Clock::time_point now) {
+    if (!group_rate_) {
+        return now;
+    }
+
+    TokenBucket* bucket = GetGroupBucket(group);
+    return bucket != &unlimited_ ? bucket->Reserve(now) : now;
+}
+
+RateLimiter::Clock::time_point RateLimiter::ReserveGlobal(
+    Clock::time_point now) {
+    return global_ ? global_->Reserve(now) : now;
+}
+
+void RateLimiter::Acquire(uint32_t group) {
+    Clock::time_point at = ReserveGroup(group, Clock::now());
+    std::this_thread::sleep_until(at);
+    at = ReserveGlobal(std::max(at, Clock::now()));
+    std::this_thread::sleep_until(at);
+}
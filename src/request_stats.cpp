@@ -0,0 +1,221 @@
+#include <curl/curl.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+
+#include "../include/json.hpp"
+#include "../include/request_stats.hpp"
+
+namespace {
+
+constexpr double kPercentiles[] = {50, 90, 99, 99.9};
+constexpr const char* kPercentileNames[] = {"p50", "p90", "p99", "p999"};
+
+uint64_t TimeOf(CURL* handle, CURLINFO info) {
+    curl_off_t value = 0;
+    if (curl_easy_getinfo(handle, info, &value) != CURLE_OK || value < 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(value);
+}
+
+uint64_t Since(uint64_t end, uint64_t start) {
+    return end > start ? end - start : 0;
+}
+
+}  // namespace
+
+constexpr size_t RequestStats::kPhaseCount;
+constexpr long RequestStats::kMaxStatusCode;
+
+RequestStats::RequestStats() {
+    for (auto& histograms : by_status_) {
+        histograms.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+RequestStats::~RequestStats() {
+    for (auto& histograms : by_status_) {
+        delete histograms.load(std::memory_order_relaxed);
+    }
+}
+
+void RequestStats::RecordTransfer(long status_code, void* curl_handle) {
+    // curl reports every time point from the start of the transfer
+    uint64_t name_lookup = TimeOf(curl_handle, CURLINFO_NAMELOOKUP_TIME_T);
+    uint64_t connect = TimeOf(curl_handle, CURLINFO_CONNECT_TIME_T);
+    uint64_t app_connect = TimeOf(curl_handle, CURLINFO_APPCONNECT_TIME_T);
+
+    Timings timings;
+    timings[Phase::Dns] = name_lookup;
+    timings[Phase::Connect] = Since(connect, name_lookup);
+    timings[Phase::Tls] = app_connect > 0 ? Since(app_connect, connect) : 0;
+    timings[Phase::FirstByte] =
+        TimeOf(curl_handle, CURLINFO_STARTTRANSFER_TIME_T);
+    timings[Phase::Total] = TimeOf(curl_handle, CURLINFO_TOTAL_TIME_T);
+    Record(status_code, timings);
+}
+
+void RequestStats::Record(long status_code, const Timings& timings) {
+    if (status_code < 0 || status_code > kMaxStatusCode) {
+        status_code = 0;
+    }
+
+    std::atomic<StatusHistograms*>& slot = by_status_[status_code];
+    StatusHistograms* histograms = slot.load(std::memory_order_acquire);
+    if (histograms == nullptr) {
+        // two threads may race to create them, the loser drops its copy
+        auto created = std::make_unique<StatusHistograms>();
+        if (slot.compare_exchange_strong(histograms, created.get(),
+                                         std::memory_order_acq_rel)) {
+            histograms = created.release();
+        }
+    }
+
+    for (size_t phase = 0; phase < kPhaseCount; phase++) {
+        histograms->phases[phase].Record(timings[phase]);
+    }
+    count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RequestStats::Start() {
+    started_ = std::chrono::steady_clock::now();
+    stopped_ = std::chrono::steady_clock::time_point();
+}
+
+void RequestStats::Stop() {
+    stopped_ = std::chrono::steady_clock::now();
+}
+
+std::chrono::microseconds RequestStats::GetElapsed() const {
+    if (started_ == std::chrono::steady_clock::time_point()) {
+        return std::chrono::microseconds(0);
+    }
+
+    auto stopped = stopped_ == std::chrono::steady_clock::time_point()
+                       ? std::chrono::steady_clock::now()
+                       : stopped_;
+    return std::chrono::duration_cast<std::chrono::microseconds>(stopped -
+                                                                 started_);
+}
+
+uint64_t RequestStats::GetCount() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+void RequestStats::CountHedge() {
+    hedges_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RequestStats::CountHedgeWin() {
+    hedge_wins_.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t RequestStats::GetHedgeCount() const {
+    return hedges_.load(std::memory_order_relaxed);
+}
+
+uint64_t RequestStats::GetHedgeWinCount() const {
+    return hedge_wins_.load(std::memory_order_relaxed);
+}
+
+double RequestStats::GetRequestsPerSecond() const {
+    auto elapsed = GetElapsed();
+    if (elapsed.count() == 0) {
+        return 0;
+    }
+    return GetCount() * 1e6 / elapsed.count();
+}
+
+const LatencyHistogram* RequestStats::GetHistogram(long status_code,
+                                                   Phase phase) const {
+    if (status_code < 0 || status_code > kMaxStatusCode) {
+        return nullptr;
+    }
+
+    StatusHistograms* histograms =
+        by_status_[status_code].load(std::memory_order_acquire);
+    return histograms != nullptr ? &histograms->phases[phase] : nullptr;
+}
+
+const char* RequestStats::PhaseName(Phase phase) {
+    static constexpr const char* kNames[kPhaseCount] = {
+        "dns", "connect", "tls", "first_byte", "total"};
+    return kNames[phase];
+}
+
+void RequestStats::PrintSummary(std::ostream* out) const {
+    // the caller's stream is given back formatted as it came
+    std::ios_base::fmtflags flags = out->flags();
+    std::streamsize precision = out->precision();
+    *out << std::fixed << std::setprecision(3) << "Requests: " << GetCount()
+         << " in " << GetElapsed().count() / 1e6 << "s, "
+         << GetRequestsPerSecond() << " requests/s" << std::endl;
+    if (GetHedgeCount() > 0) {
+        *out << "Hedged requests: " << GetHedgeCount()
+             << ", replied first: " << GetHedgeWinCount() << std::endl;
+    }
+
+    for (long code = 0; code <= kMaxStatusCode; code++) {
+        const LatencyHistogram* total = GetHistogram(code, Phase::Total);
+        if (total == nullptr) {
+            continue;
+        }
+
+        *out << "Status " << code << ": " << total->GetCount()
+             << " requests, latency in ms" << std::endl;
+        for (size_t phase = 0; phase < kPhaseCount; phase++) {
+            const LatencyHistogram* histogram =
+                GetHistogram(code, static_cast<Phase>(phase));
+            *out << "    " << std::left << std::setw(11)
+                 << PhaseName(static_cast<Phase>(phase)) << std::right;
+            for (size_t i = 0; i < std::size(kPercentiles); i++) {
+                *out << " " << kPercentileNames[i] << " "
+                     << histogram->GetPercentile(kPercentiles[i]) / 1e3;
+            }
+            *out << " max " << histogram->GetMax() / 1e3 << std::endl;
+        }
+    }
+    out->flags(flags);
+    out->precision(precision);
+}
+
+bool RequestStats::WriteJson(const std::string& fname) const {
+    nlohmann::json json;
+    json["requests"] = GetCount();
+    json["elapsed_us"] = GetElapsed().count();
+    json["requests_per_second"] = GetRequestsPerSecond();
+    json["hedged_requests"] = GetHedgeCount();
+    json["hedged_requests_won"] = GetHedgeWinCount();
+    json["status_codes"] = nlohmann::json::object();
+
+    // every latency in microseconds
+    for (long code = 0; code <= kMaxStatusCode; code++) {
+        if (GetHistogram(code, Phase::Total) == nullptr) {
+            continue;
+        }
+
+        nlohmann::json& status = json["status_codes"][std::to_string(code)];
+        status["count"] = GetHistogram(code, Phase::Total)->GetCount();
+        for (size_t phase = 0; phase < kPhaseCount; phase++) {
+            const LatencyHistogram* histogram =
+                GetHistogram(code, static_cast<Phase>(phase));
+            nlohmann::json& times =
+                status[PhaseName(static_cast<Phase>(phase))];
+            for (size_t i = 0; i < std::size(kPercentiles); i++) {
+                times[kPercentileNames[i]] =
+                    histogram->GetPercentile(kPercentiles[i]);
+            }
+            times["max"] = histogram->GetMax();
+            times["mean"] = histogram->GetMean();
+        }
+    }
+
+    std::ofstream output_file(fname, std::ios::trunc);
+    if (!output_file.is_open()) {
+        return false;
+    }
+    output_file << json.dump(2) << std::endl;
+    return output_file.good();
+}
@@ -0,0 +1,73 @@
+#include <cstring>
+
+#include "../include/request_template.hpp"
+
+namespace {
+
+constexpr char kClientIdHeader[] = "x-client-id: ";
+constexpr size_t kClientIdHeaderSize = sizeof(kClientIdHeader) - 1;
+constexpr char kTokenHeader[] = "x-authentication-token: ";
+constexpr char kContentTypeHeader[] = "Content-Type: application/json";
+
+}  // namespace
+
+constexpr size_t RequestTemplate::kMacLength;
+constexpr size_t RequestTemplate::kMaxClientIdDigits;
+
+RequestTemplate::RequestTemplate(const std::string& url_prefix)
+    : url_prefix_(url_prefix) {}
+
+void RequestTemplate::InitUrl(std::string* url) const {
+    url->reserve(url_prefix_.size() + kMacLength);
+    url->assign(url_prefix_);
+    url->append(kMacLength, '0');
+}
+
+void RequestTemplate::PatchUrl(const std::string& mac_addr,
+                               std::string* url) const {
+    // the common case overwrites the mac bytes of the buffer
+    if (mac_addr.size() == kMacLength &&
+        url->size() == url_prefix_.size() + kMacLength) {
+        memcpy(&(*url)[url_prefix_.size()], mac_addr.data(), kMacLength);
+        return;
+    }
+
+    url->resize(url_prefix_.size());
+    url->append(mac_addr);
+}
+
+void RequestTemplate::PatchUrl(const MacAddress& mac, std::string* url) const {
+    url->resize(url_prefix_.size() + kMacLength);
+    mac.Format(&(*url)[url_prefix_.size()]);
+}
+
+void RequestTemplate::InitClientIdHeader(std::string* header) const {
+    header->reserve(kClientIdHeaderSize + kMaxClientIdDigits);
+    header->assign(kClientIdHeader);
+}
+
+void RequestTemplate::PatchClientIdHeader(uint32_t client_id,
+                                          std::string* header) const {
+    char digits[kMaxClientIdDigits];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + client_id % 10);
+        client_id /= 10;
+    } while (client_id != 0);
+
+    // stays inside the capacity reserved by InitClientIdHeader
+    header->resize(kClientIdHeaderSize);
+    while (count > 0) {
+        header->push_back(digits[--count]);
+    }
+}
+
+void RequestTemplate::FormatTokenHeader(const std::string& token,
+                                        std::string* header) const {
+    header->assign(kTokenHeader);
+    header->append(token);
+}
+
+const char* RequestTemplate::GetContentTypeHeader() const {
+    return kContentTypeHeader;
+}
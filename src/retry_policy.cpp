@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "../include/json.hpp"
+#include "../include/retry_policy.hpp"
+
+namespace {
+
+bool LoadRule(const nlohmann::json& json, const char* name,
+              RetryPolicy::Rule* rule) {
+    if (!json.contains(name)) {
+        return true;
+    }
+
+    const auto& entry = json[name];
+    int64_t max_retries = entry.value("max_retries",
+                                      static_cast<int64_t>(rule->max_retries));
+    int64_t base_delay = entry.value("base_delay_ms",
+                                     static_cast<int64_t>(
+                                         rule->base_delay.count()));
+    int64_t max_delay = entry.value("max_delay_ms",
+                                    std::max<int64_t>(
+                                        base_delay, rule->max_delay.count()));
+    if (max_retries < 0 || base_delay < 0 || max_delay < base_delay) {
+        std::cout << "Invalid retry policy for " << name << std::endl;
+        return false;
+    }
+
+    rule->max_retries = static_cast<uint32_t>(max_retries);
+    rule->base_delay = std::chrono::milliseconds(base_delay);
+    rule->max_delay = std::chrono::milliseconds(max_delay);
+    return true;
+}
+
+}  // namespace
+
+bool RetryPolicy::Load(const char* fname) {
+    std::ifstream input_file(fname);
+    if (!input_file.is_open()) {
+        std::cout << "Unable to open the retry policy " << fname << std::endl;
+        return false;
+    }
+
+    std::stringstream file_stream;
+    file_stream << input_file.rdbuf();
+    auto json = nlohmann::json::parse(file_stream.str(), nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        std::cout << "The retry policy is not a json object" << std::endl;
+        return false;
+    }
+
+    try {
+        return LoadRule(json, "unauthorized", &unauthorized) &&
+               LoadRule(json, "throttled", &throttled) &&
+               LoadRule(json, "server_error", &server_error) &&
+               LoadRule(json, "transport_error", &transport_error);
+    } catch (nlohmann::json::exception const& e) {
+        std::cout << "Invalid retry policy: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+const RetryPolicy::Rule* RetryPolicy::GetRule(
+    NetworkUpdater::UpdaterErr status, uint32_t status_code) const {
+    // a 401 the token could not be refreshed for fails for good
+    if (status == NetworkUpdater::UpdaterErr::Retry) {
+        return &unauthorized;
+    }
+    if (status_code == 0) {
+        return &transport_error;
+    }
+    if (status_code == 429) {
+        return &throttled;
+    }
+    if (status_code >= 500) {
+        return &server_error;
+    }
+    return nullptr;
+}
+
+std::chrono::milliseconds RetryPolicy::GetDelay(const Rule& rule,
+                                                uint32_t retry,
+                                                std::mt19937_64* rng) {
+    // past 2^20 times the base any delay is capped anyway. A base that
+    // would overflow the shift is past the cap already.
+    uint32_t shift = std::min<uint32_t>(retry, 20);
+    int64_t delay = rule.max_delay.count();
+    if (rule.base_delay.count() <= (delay >> shift)) {
+        delay = rule.base_delay.count() << shift;
+    }
+
+    int64_t half = delay / 2;
+    return std::chrono::milliseconds(
+        half +
+        std::uniform_int_distribution<int64_t>(0, delay - half)(*rng));
+}
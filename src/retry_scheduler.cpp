@@ -0,0 +1,137 @@
+#include <algorithm>
+
+#include "../include/retry_scheduler.hpp"
+
+constexpr std::chrono::milliseconds RetryScheduler::kTick;
+constexpr size_t RetryScheduler::kSlotCount;
+
+static_assert((RetryScheduler::kSlotCount &
+               (RetryScheduler::kSlotCount - 1)) == 0,
+              "the slot of a tick is found with a mask");
+
+RetryScheduler::RetryScheduler()
+    : epoch_(Clock::now()), slots_(kSlotCount) {}
+
+uint64_t RetryScheduler::ToTick(Clock::time_point time) const {
+    if (time <= epoch_) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time - epoch_)
+               .count() /
+           kTick.count();
+}
+
+RetryScheduler::Clock::time_point RetryScheduler::ToTime(uint64_t tick) const {
+    return epoch_ + kTick * tick;
+}
+
+void RetryScheduler::Schedule(const Entry& entry, Clock::time_point due) {
+    size_++;
+    // rounded up, a retry never goes before its time
+    uint64_t tick = ToTick(due);
+    if (ToTime(tick) < due) {
+        tick++;
+    }
+
+    if (tick < next_tick_) {
+        due_.push_back(entry);
+        return;
+    }
+    slots_[tick & (kSlotCount - 1)].push_back({tick, entry});
+}
+
+void RetryScheduler::ExpireSlot(std::vector<Timer>* slot, uint64_t tick) {
+    // the timers of the later turns keep their order in the slot
+    size_t kept = 0;
+    for (Timer& timer : *slot) {
+        if (timer.tick <= tick) {
+            due_.push_back(timer.entry);
+        } else {
+            (*slot)[kept++] = timer;
+        }
+    }
+    slot->resize(kept);
+}
+
+void RetryScheduler::Expire(uint64_t tick) {
+    if (tick < next_tick_) {
+        return;
+    }
+
+    if (tick - next_tick_ < kSlotCount) {
+        for (uint64_t t = next_tick_; t <= tick; t++) {
+            ExpireSlot(&slots_[t & (kSlotCount - 1)], tick);
+        }
+    } else {
+        // a whole turn went by, the slots no longer come in due order
+        std::vector<Timer> expired;
+        for (auto& slot : slots_) {
+            size_t kept = 0;
+            for (Timer& timer : slot) {
+                if (timer.tick <= tick) {
+                    expired.push_back(timer);
+                } else {
+                    slot[kept++] = timer;
+                }
+            }
+            slot.resize(kept);
+        }
+
+        std::stable_sort(expired.begin(), expired.end(),
+                         [](const Timer& a, const Timer& b) {
+                             return a.tick < b.tick;
+                         });
+        for (const Timer& timer : expired) {
+            due_.push_back(timer.entry);
+        }
+    }
+
+    next_tick_ = tick + 1;
+}
+
+bool RetryScheduler::PopDue(Clock::time_point now, Entry* entry) {
+    Expire(ToTick(now));
+    if (due_.empty()) {
+        return false;
+    }
+
+    *entry = due_.front();
+    due_.pop_front();
+    size_--;
+    return true;
+}
+
+RetryScheduler::Clock::time_point RetryScheduler::GetNextDue() const {
+    if (!due_.empty()) {
+        return epoch_;
+    }
+
+    // the first slot holding a timer of the current turn has the earliest
+    // one, otherwise every timer is at least a turn away
+    uint64_t earliest = UINT64_MAX;
+    for (uint64_t t = next_tick_; t < next_tick_ + kSlotCount; t++) {
+        for (const Timer& timer : slots_[t & (kSlotCount - 1)]) {
+            if (timer.tick == t) {
+                return ToTime(t);
+            }
+            earliest = std::min(earliest, timer.tick);
+        }
+    }
+    return ToTime(earliest);
+}
+
+size_t RetryScheduler::size() const {
+    return size_;
+}
+
+bool RetryScheduler::empty() const {
+    return size_ == 0;
+}
+
+void RetryScheduler::Clear() {
+    for (auto& slot : slots_) {
+        slot.clear();
+    }
+    due_.clear();
+    size_ = 0;
+}
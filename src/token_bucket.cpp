@@ -0,0 +1,30 @@
+#include <algorithm>
+
+#include "../include/token_bucket.hpp"
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate),
+      interval_(static_cast<int64_t>(1e9 / rate)),
+      tolerance_(static_cast<int64_t>((std::max(burst, 1.0) - 1) *
+                                      interval_)) {}
+
+TokenBucket::Clock::time_point TokenBucket::Reserve(Clock::time_point now) {
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         now.time_since_epoch())
+                         .count();
+
+    // an idle bucket fills up to burst tokens, no more
+    int64_t next_token = next_token_.load(std::memory_order_relaxed);
+    int64_t token;
+    do {
+        token = std::max(next_token, now_ns - tolerance_);
+    } while (!next_token_.compare_exchange_weak(next_token, token + interval_,
+                                                std::memory_order_relaxed));
+
+    return Clock::time_point(std::chrono::duration_cast<Clock::duration>(
+        std::chrono::nanoseconds(std::max(token, now_ns))));
+}
+
+double TokenBucket::GetRate() const {
+    return rate_;
+}
@@ -0,0 +1,87 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+#include "../include/json.hpp"
+#include "../include/token_cache.hpp"
+
+namespace {
+
+int64_t UnixNow() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+}  // namespace
+
+TokenCache::TokenCache(const std::string& fname) : fname_(fname) {}
+
+bool TokenCache::Load(const std::string& token_url,
+                      std::chrono::seconds min_validity, std::string* token,
+                      std::chrono::seconds* expires_in) const {
+    std::ifstream input_file(fname_);
+    if (!input_file.is_open()) {
+        return false;
+    }
+
+    std::stringstream file_stream;
+    file_stream << input_file.rdbuf();
+    auto json = nlohmann::json::parse(file_stream.str(), nullptr, false);
+    if (json.is_discarded() || !json.is_object() ||
+        !json["token_url"].is_string() || json["token_url"] != token_url ||
+        !json["token"].is_string() || !json["expires_at"].is_number()) {
+        return false;
+    }
+
+    int64_t expires_at = json["expires_at"];
+    int64_t left = expires_at - UnixNow();
+    if (expires_at != 0 && left <= min_validity.count()) {
+        return false;
+    }
+
+    *token = json["token"];
+    *expires_in = std::chrono::seconds(expires_at != 0 ? left : 0);
+    return true;
+}
+
+bool TokenCache::Store(const std::string& token_url, const std::string& token,
+                       std::chrono::seconds expires_in) const {
+    nlohmann::json json;
+    json["token_url"] = token_url;
+    json["token"] = token;
+    json["expires_at"] =
+        expires_in.count() > 0 ? UnixNow() + expires_in.count() : 0;
+
+    // written aside under a name of its own and renamed, a concurrent run
+    // never reads half a file. mkstemp creates it for the owner only.
+    std::string tmp_fname = fname_ + ".XXXXXX";
+    int fd = mkstemp(&tmp_fname[0]);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string contents = json.dump();
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t count = write(fd, contents.data() + written,
+                              contents.size() - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(count);
+    }
+
+    bool stored = close(fd) == 0 && written == contents.size() &&
+                  rename(tmp_fname.c_str(), fname_.c_str()) == 0;
+    if (!stored) {
+        unlink(tmp_fname.c_str());
+    }
+    return stored;
+}
@@ -0,0 +1,171 @@
+#include <algorithm>
+
+#include "../include/token_manager.hpp"
+
+constexpr std::chrono::seconds TokenManager::kDefaultRefreshMargin;
+constexpr std::chrono::seconds TokenManager::kRefreshRetryDelay;
+
+TokenManager::TokenManager(Fetch fetch, std::chrono::seconds refresh_margin)
+    : fetch_(std::move(fetch)), refresh_margin_(refresh_margin) {
+    // an already expired placeholder, the first reader fetches a real token
+    tokens_.push_back(std::make_unique<Token>(
+        Token{"", 0, std::chrono::steady_clock::time_point(),
+              std::chrono::steady_clock::time_point()}));
+    current_ = tokens_.back().get();
+}
+
+TokenManager::~TokenManager() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (refresher_.joinable()) {
+        refresher_.join();
+    }
+}
+
+const TokenManager::Token& TokenManager::Current() {
+    const Token* token = current_.load(std::memory_order_acquire);
+    auto now = std::chrono::steady_clock::now();
+    if (now < token->refresh_at) {
+        return *token;
+    }
+
+    if (now >= token->expires_at) {
+        // nothing to send with, every reader waits for the single refresh
+        Refresh(token->generation);
+    } else if (!refresh_pending_.exchange(true)) {
+        // still valid, only the first reader refreshes ahead of the expiry
+        Refresh(token->generation);
+        refresh_pending_ = false;
+    }
+
+    return *current_.load(std::memory_order_acquire);
+}
+
+const TokenManager::Token& TokenManager::Peek() const {
+    return *current_.load(std::memory_order_acquire);
+}
+
+bool TokenManager::Refresh(uint64_t generation) {
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    if (current_.load(std::memory_order_acquire)->generation != generation) {
+        // replaced while this caller was parked on the mutex
+        return true;
+    }
+
+    // the callers parked behind a failed fetch fail with it instead of
+    // asking the endpoint again one after the other
+    {
+        std::lock_guard<std::mutex> wait_lock(wait_mutex_);
+        if (FailedRecently(generation)) {
+            return false;
+        }
+    }
+
+    std::string value;
+    std::chrono::seconds expires_in{0};
+    if (!fetch_(&value, &expires_in)) {
+        std::lock_guard<std::mutex> wait_lock(wait_mutex_);
+        failed_generation_ = generation;
+        failed_at_ = std::chrono::steady_clock::now();
+        return false;
+    }
+
+    Publish(std::move(value), expires_in);
+    return true;
+}
+
+TokenManager::RefreshState TokenManager::PollRefresh(uint64_t generation) {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        // Publish swaps the token under this mutex too
+        if (current_.load(std::memory_order_acquire)->generation !=
+            generation) {
+            return RefreshState::Done;
+        }
+        if (FailedRecently(generation)) {
+            return RefreshState::Failed;
+        }
+        polled_generation_ = generation;
+    }
+
+    wake_.notify_all();
+    return RefreshState::Pending;
+}
+
+bool TokenManager::FailedRecently(uint64_t generation) const {
+    return failed_generation_ == generation &&
+           std::chrono::steady_clock::now() - failed_at_ < kRefreshRetryDelay;
+}
+
+uint64_t TokenManager::GetRefreshCount() const {
+    return refresh_count_;
+}
+
+std::chrono::seconds TokenManager::GetRefreshMargin() const {
+    return refresh_margin_;
+}
+
+void TokenManager::StartBackgroundRefresh() {
+    if (!refresher_.joinable()) {
+        refresher_ = std::thread(&TokenManager::BackgroundRefresh, this);
+    }
+}
+
+void TokenManager::BackgroundRefresh() {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    while (!stopping_) {
+        const Token* token = current_.load(std::memory_order_acquire);
+        auto woken = [this, token] {
+            return stopping_ || polled_generation_ == token->generation ||
+                   current_.load(std::memory_order_acquire) != token;
+        };
+
+        if (polled_generation_ != token->generation) {
+            // a token that does not expire is only replaced after a 401
+            if (token->refresh_at ==
+                std::chrono::steady_clock::time_point::max()) {
+                wake_.wait(lock, woken);
+                continue;
+            }
+            if (wake_.wait_until(lock, token->refresh_at, woken)) {
+                continue;
+            }
+        }
+
+        polled_generation_ = UINT64_MAX;
+        lock.unlock();
+        bool refreshed = Refresh(token->generation);
+        lock.lock();
+        if (!refreshed) {
+            wake_.wait_for(lock, kRefreshRetryDelay, [this] {
+                return stopping_;
+            });
+        }
+    }
+}
+
+void TokenManager::Publish(std::string value, std::chrono::seconds expires_in) {
+    const Token* previous = current_.load(std::memory_order_acquire);
+    auto expires_at = std::chrono::steady_clock::time_point::max();
+    auto refresh_at = expires_at;
+    if (expires_in.count() > 0) {
+        expires_at = std::chrono::steady_clock::now() + expires_in;
+        // a token shorter lived than the margin would be refreshed at once,
+        // over and over
+        std::chrono::steady_clock::duration lifetime = expires_in;
+        refresh_at = expires_at - std::min<std::chrono::steady_clock::duration>(
+                                      refresh_margin_, lifetime / 2);
+    }
+
+    tokens_.push_back(std::make_unique<Token>(Token{
+        std::move(value), previous->generation + 1, expires_at, refresh_at}));
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        current_.store(tokens_.back().get(), std::memory_order_release);
+    }
+    wake_.notify_all();
+    refresh_count_++;
+}
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../include/mac_list_reader.hpp"
+#include "../include/multi_transport.hpp"
+#include "../include/update_dispatcher.hpp"
+
+UpdateDispatcher::UpdateDispatcher(NetworkUpdater* updater, std::ostream* log,
+                                   uint32_t concurrency, bool fail_fast,
+                                   Mode mode)
+    : updater_(updater),
+      log_(log),
+      concurrency_(std::max<uint32_t>(concurrency, 1)),
+      fail_fast_(fail_fast),
+      mode_(mode) {}
+
+void UpdateDispatcher::SetAdaptiveConcurrency(bool adaptive) {
+    if (!adaptive) {
+        limiter_.reset();
+        return;
+    }
+
+    limiter_ = std::make_unique<ConcurrencyLimiter>(
+        1, concurrency_,
+        std::min(concurrency_, ConcurrencyLimiter::kDefaultInitialLimit));
+}
+
+const ConcurrencyLimiter* UpdateDispatcher::GetLimiter() const {
+    return limiter_.get();
+}
+
+void UpdateDispatcher::SetRateLimit(
+    double global_rate, double group_rate,
+    const std::map<std::string, double>& group_rates) {
+    RateLimiter::GroupRate rate_of_group;
+    if (updater_->GetGroupColumn() > 0) {
+        // asked once per group, the first time one of its hosts is sent
+        NetworkUpdater* updater = updater_;
+        rate_of_group = [updater, group_rate, group_rates](uint32_t group) {
+            auto rate = group_rates.find(updater->GetGroupName(group));
+            return rate != group_rates.end() ? rate->second : group_rate;
+        };
+    }
+
+    rate_limiter_ =
+        std::make_unique<RateLimiter>(global_rate, std::move(rate_of_group));
+}
+
+void UpdateDispatcher::SetRetryPolicy(const RetryPolicy& policy) {
+    retry_policy_ = policy;
+}
+
+void UpdateDispatcher::SetHedging(bool enabled) {
+    hedging_ = enabled;
+}
+
+NetworkUpdater::UpdaterErr UpdateDispatcher::Run() {
+    next_host_ = 0;
+    aborted_ = false;
+    retries_.Clear();
+    hosts_done_ = false;
+    in_progress_ = 0;
+    if (updater_->GetMacReader() != nullptr) {
+        updater_->GetMacReader()->Rewind();
+        streamed_hosts_.clear();
+    }
+
+    if (mode_ == Mode::EventLoop) {
+        RunEventLoop();
+        return aborted_ ? NetworkUpdater::UpdaterErr::Fail
+                        : NetworkUpdater::UpdaterErr::Ok;
+    }
+
+    // the size of a streamed hosts file is only known at its end
+    size_t workers_count = concurrency_;
+    if (updater_->GetMacReader() == nullptr) {
+        workers_count = std::min<size_t>(workers_count,
+                                         updater_->GetMacList().size());
+    }
+
+    // a single worker keeps the original behavior, no need for a thread
+    if (workers_count <= 1) {
+        Worker();
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(workers_count);
+        for (size_t i = 0; i < workers_count; i++) {
+            workers.emplace_back(&UpdateDispatcher::Worker, this);
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    return aborted_ ? NetworkUpdater::UpdaterErr::Fail
+                    : NetworkUpdater::UpdaterErr::Ok;
+}
+
+void UpdateDispatcher::RunEventLoop() {
+    MultiTransport transport(updater_, concurrency_);
+    transport.SetHedging(hedging_);
+
+    // the job the rate limiter holds back and the time it may go, booked
+    // in its group first and in the global budget once that time came
+    MultiTransport::Job held;
+    bool holding = false;
+    bool global_booked = false;
+    std::chrono::steady_clock::time_point held_until;
+
+    CircuitBreaker& breaker = updater_->GetCircuitBreaker();
+    auto next_job = [&](MultiTransport::Job* job) {
+        if (aborted_) {
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        while (!holding) {
+            Host host;
+            if (!NextAttempt(&host, false)) {
+                // only retries are left, come back when the first is due
+                if (!aborted_ && !retries_.empty()) {
+                    transport.WakeAt(retries_.GetNextDue());
+                }
+                return false;
+            }
+
+            // the server is failing, the host fails without a rate token
+            if (!breaker.Allow(&held.probe)) {
+                FinishAttempt(host, NetworkUpdater::UpdaterErr::Fail, 0);
+                continue;
+            }
+
+            held.mac = host.mac;
+            held.group = host.group;
+            held.attempt = host.attempt;
+            holding = true;
+            global_booked = !rate_limiter_;
+            held_until = rate_limiter_
+                             ? rate_limiter_->ReserveGroup(held.group, now)
+                             : now;
+        }
+
+        if (!global_booked && held_until <= now) {
+            held_until = rate_limiter_->ReserveGlobal(now);
+            global_booked = true;
+        }
+        if (held_until > now) {
+            transport.WakeAt(held_until);
+            return false;
+        }
+
+        // the transport asks again once a transfer is over
+        if (limiter_ && !limiter_->TryAcquire()) {
+            return false;
+        }
+
+        holding = false;
+        *job = held;
+        job->started_at = now;
+        return true;
+    };
+
+    auto job_done = [&](const MultiTransport::Job& job,
+                        NetworkUpdater::UpdaterErr status,
+                        uint32_t status_code) {
+        if (limiter_) {
+            limiter_->Release(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - job.started_at),
+                ConcurrencyLimiter::IsDropped(status_code));
+        }
+        breaker.Record(CircuitBreaker::IsFailure(status_code), job.probe);
+
+        FinishAttempt({job.mac, job.group, job.attempt}, status, status_code);
+    };
+
+    transport.Run(next_job, job_done);
+}
+
+void UpdateDispatcher::Worker() {
+    // every update of the worker is built in the same buffers
+    NetworkUpdater::RequestBuffers buffers;
+    Host host;
+    while (NextAttempt(&host, true)) {
+        UpdateHost(host, &buffers);
+    }
+}
+
+bool UpdateDispatcher::NextAttempt(Host* host, bool wait) {
+    std::unique_lock<std::mutex> lock(retry_mutex_);
+    while (!aborted_) {
+        if (retries_.PopDue(std::chrono::steady_clock::now(), host)) {
+            in_progress_++;
+            return true;
+        }
+
+        if (!hosts_done_) {
+            // the fresh hosts come from a source of their own, the workers
+            // do not queue on this mutex for them. Counted in progress
+            // first, so no worker takes the run for over meanwhile.
+            in_progress_++;
+            lock.unlock();
+            bool found = NextHost(&host->mac, &host->group);
+            lock.lock();
+            if (found) {
+                host->attempt = 0;
+                return true;
+            }
+            in_progress_--;
+            hosts_done_ = true;
+            // the workers waiting on this lookup may be done now, and a
+            // retry may have come due while the lock was released
+            retry_changed_.notify_all();
+            continue;
+        }
+
+        // the attempts still running may schedule more retries
+        if (!wait || (retries_.empty() && in_progress_ == 0)) {
+            break;
+        }
+        if (retries_.empty()) {
+            retry_changed_.wait(lock);
+        } else {
+            retry_changed_.wait_until(lock, retries_.GetNextDue());
+        }
+    }
+
+    return false;
+}
+
+bool UpdateDispatcher::NextHost(MacAddress* mac, uint32_t* group) {
+    MacListReader* reader = updater_->GetMacReader();
+    if (reader != nullptr) {
+        std::string_view mac_addr;
+        std::lock_guard<std::mutex> lock(reader_mutex_);
+        while (reader->Next(&mac_addr)) {
+            if (!MacAddress::Parse(mac_addr, mac)) {
+                updater_->RejectHost(reader->GetLineNumber(), mac_addr);
+            } else if (!streamed_hosts_.insert(*mac)) {
+                updater_->CountDuplicateHost();
+            } else {
+                size_t group_column = updater_->GetGroupColumn();
+                *group = group_column > 0 ? updater_->GetHostGroup(
+                                                reader->GetColumn(group_column))
+                                          : 0;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    const MacList& mac_list = updater_->GetMacList();
+    size_t index = next_host_.fetch_add(1);
+    if (index >= mac_list.size()) {
+        return false;
+    }
+
+    *mac = mac_list[index];
+    *group = mac_list.group(index);
+    return true;
+}
+
+void UpdateDispatcher::UpdateHost(const Host& host,
+                                  NetworkUpdater::RequestBuffers* buffers) {
+    uint32_t status_code = 0;
+    NetworkUpdater::UpdaterErr status =
+        Send(host.mac, host.group, buffers, &status_code);
+    FinishAttempt(host, status, status_code);
+}
+
+NetworkUpdater::UpdaterErr UpdateDispatcher::Send(
+    const MacAddress& mac, uint32_t group,
+    NetworkUpdater::RequestBuffers* buffers, uint32_t* status_code) {
+    // the server is failing, give up before taking a rate token
+    CircuitBreaker& breaker = updater_->GetCircuitBreaker();
+    bool probe = false;
+    if (!breaker.Allow(&probe)) {
+        *status_code = 0;
+        return NetworkUpdater::UpdaterErr::Fail;
+    }
+
+    // paced first, a request waiting for its slot does not hold a
+    // concurrency one
+    if (rate_limiter_) {
+        rate_limiter_->Acquire(group);
+    }
+    if (limiter_) {
+        limiter_->Acquire();
+    }
+    auto started_at = std::chrono::steady_clock::now();
+    NetworkUpdater::UpdaterErr status =
+        updater_->SendRequest(mac, buffers, status_code);
+    if (limiter_) {
+        limiter_->Release(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started_at),
+            ConcurrencyLimiter::IsDropped(*status_code));
+    }
+    breaker.Record(CircuitBreaker::IsFailure(*status_code), probe);
+    return status;
+}
+
+void UpdateDispatcher::FinishAttempt(const Host& host,
+                                     NetworkUpdater::UpdaterErr status,
+                                     uint32_t status_code) {
+    const RetryPolicy::Rule* rule =
+        status != NetworkUpdater::UpdaterErr::Ok
+            ? retry_policy_.GetRule(status, status_code)
+            : nullptr;
+    bool failed = status != NetworkUpdater::UpdaterErr::Ok;
+    bool retrying = false;
+    std::chrono::milliseconds delay{0};
+    {
+        std::lock_guard<std::mutex> lock(retry_mutex_);
+        in_progress_--;
+        if (rule != nullptr && host.attempt < rule->max_retries &&
+            !aborted_) {
+            delay = RetryPolicy::GetDelay(*rule, host.attempt, &jitter_);
+            retries_.Schedule({host.mac, host.group, host.attempt + 1},
+                              std::chrono::steady_clock::now() + delay);
+            retrying = true;
+        }
+    }
+
+    // logged outside of the lock, the log stream may be slow
+    if (retrying) {
+        Log("Retrying to send request for host mac: " + host.mac.ToString() +
+            " in " + std::to_string(delay.count()) + " ms");
+    } else if (failed) {
+        ReportFailure(host.mac);
+    }
+    // wakes the workers waiting for a retry, or for the last attempts
+    retry_changed_.notify_all();
+}
+
+void UpdateDispatcher::ReportFailure(const MacAddress& mac) {
+    if (!fail_fast_) {
+        Log("Unable to send request for the host with mac " + mac.ToString());
+        return;
+    }
+
+    // only the first failing worker reports, the others just stop
+    if (!aborted_.exchange(true)) {
+        std::cout << "Unable to send request for the host with mac "
+                  << mac.ToString()
+                  << std::endl;
+    }
+}
+
+void UpdateDispatcher::Log(const std::string& line) {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    *log_ << line << std::endl;
+}
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "./allocation_counter.hpp"
+
+namespace {
+
+thread_local bool counting{false};
+thread_local size_t count{0};
+thread_local size_t largest{0};
+
+void* Allocate(size_t size) {
+    if (counting) {
+        count++;
+        largest = std::max(largest, size);
+    }
+
+    // malloc(0) may return nullptr, operator new may not
+    void* ptr = malloc(std::max<size_t>(size, 1));
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+}  // namespace
+
+void AllocationCounter::Start() {
+    count = 0;
+    largest = 0;
+    counting = true;
+}
+
+void AllocationCounter::Stop() {
+    counting = false;
+}
+
+size_t AllocationCounter::GetCount() {
+    return count;
+}
+
+size_t AllocationCounter::GetLargest() {
+    return largest;
+}
+
+// Kept out of line in a file of their own, a delete inlined next to the new
+// it pairs with makes the compiler warn about the free
+void* operator new(size_t size) {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return Allocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
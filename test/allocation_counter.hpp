@@ -0,0 +1,20 @@
+#ifndef ALLOCATION_COUNTER_
+#define ALLOCATION_COUNTER_
+
+#include <cstddef>
+
+// Counts the heap allocations the calling thread makes between Start and
+// Stop. Linking allocation_counter.cpp replaces the global operator new and
+// delete of the whole binary with malloc and free; the other threads, the in
+// process test servers among them, go through them uncounted.
+class AllocationCounter {
+ public:
+    // Starts over from 0
+    static void Start();
+    static void Stop();
+    static size_t GetCount();
+    // Size of the largest allocation counted
+    static size_t GetLargest();
+};
+
+#endif  // ALLOCATION_COUNTER_
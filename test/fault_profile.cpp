@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "../include/json.hpp"
+#include "./fault_profile.hpp"
+
+namespace {
+
+bool IsRate(double rate) {
+    return rate >= 0 && rate <= 1;
+}
+
+double SampleUnit(std::mt19937_64* rng) {
+    return std::uniform_real_distribution<double>(0, 1)(*rng);
+}
+
+std::chrono::microseconds Milliseconds(const nlohmann::json& json,
+                                       const char* key) {
+    return std::chrono::microseconds(
+        static_cast<int64_t>(json.value(key, 0.0) * 1000));
+}
+
+}  // namespace
+
+bool FaultProfile::Load(const char* fname) {
+    std::ifstream input_file(fname);
+    if (!input_file.is_open()) {
+        std::cout << "Unable to open the fault profile " << fname << std::endl;
+        return false;
+    }
+
+    std::stringstream file_stream;
+    file_stream << input_file.rdbuf();
+    auto json = nlohmann::json::parse(file_stream.str(), nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        std::cout << "The fault profile is not a json object" << std::endl;
+        return false;
+    }
+
+    try {
+        seed = json.value("seed", 0ULL);
+
+        if (json.contains("latency")) {
+            const auto& latency = json["latency"];
+            std::string distribution = latency.value("distribution", "none");
+            if (distribution == "fixed") {
+                this->latency = Latency::Fixed;
+            } else if (distribution == "uniform") {
+                this->latency = Latency::Uniform;
+            } else if (distribution == "long_tail") {
+                this->latency = Latency::LongTail;
+            } else if (distribution != "none") {
+                std::cout << "Unknown latency distribution " << distribution
+                          << std::endl;
+                return false;
+            }
+            latency_min = Milliseconds(latency, "min_ms");
+            latency_max =
+                std::max(latency_min, Milliseconds(latency, "max_ms"));
+            latency_shape = latency.value("shape", latency_shape);
+        }
+
+        reset_rate = json.value("reset_rate", 0.0);
+        stall_rate = json.value("stall_rate", 0.0);
+
+        if (json.contains("slow_read")) {
+            const auto& slow_read = json["slow_read"];
+            slow_read_rate = slow_read.value("rate", 0.0);
+            // signed, a negative count would wrap around into a huge chunk
+            int64_t bytes = slow_read.value(
+                "bytes", static_cast<int64_t>(slow_read_bytes));
+            if (bytes <= 0) {
+                std::cout << "Invalid fault profile values" << std::endl;
+                return false;
+            }
+            slow_read_bytes = static_cast<size_t>(bytes);
+            if (slow_read.contains("interval_ms")) {
+                slow_read_interval = Milliseconds(slow_read, "interval_ms");
+            }
+        }
+
+        if (json.contains("error_rates")) {
+            double total = 0;
+            for (const auto& error : json["error_rates"].items()) {
+                int code = std::stoi(error.key());
+                double rate = error.value().get<double>();
+                if (code < 100 || code > 599 || !IsRate(rate)) {
+                    std::cout << "Invalid error rate for " << error.key()
+                              << std::endl;
+                    return false;
+                }
+                error_rates[code] = rate;
+                total += rate;
+            }
+            if (total > 1) {
+                std::cout << "The error rates add up to more than 1"
+                          << std::endl;
+                return false;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << "Invalid fault profile: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (!IsRate(reset_rate) || !IsRate(stall_rate) ||
+        !IsRate(slow_read_rate) || latency_min.count() < 0 ||
+        latency_shape <= 0) {
+        std::cout << "Invalid fault profile values" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool FaultProfile::IsActive() const {
+    return latency != Latency::None || reset_rate > 0 || stall_rate > 0 ||
+           slow_read_rate > 0 || !error_rates.empty();
+}
+
+std::chrono::microseconds FaultProfile::SampleLatency(
+    std::mt19937_64* rng) const {
+    switch (latency) {
+        case Latency::Fixed:
+            return latency_min;
+
+        case Latency::Uniform:
+            return std::chrono::microseconds(
+                std::uniform_int_distribution<int64_t>(
+                    latency_min.count(), latency_max.count())(*rng));
+
+        case Latency::LongTail: {
+            // inverse transform of the Pareto distribution
+            double unit = 1 - SampleUnit(rng);
+            double sample =
+                latency_min.count() / std::pow(unit, 1 / latency_shape);
+            return std::chrono::microseconds(static_cast<int64_t>(
+                std::min<double>(sample, latency_max.count())));
+        }
+
+        default:
+            return std::chrono::microseconds(0);
+    }
+}
+
+bool FaultProfile::SampleReset(std::mt19937_64* rng) const {
+    return reset_rate > 0 && SampleUnit(rng) < reset_rate;
+}
+
+bool FaultProfile::SampleStall(std::mt19937_64* rng) const {
+    return stall_rate > 0 && SampleUnit(rng) < stall_rate;
+}
+
+bool FaultProfile::SampleSlowRead(std::mt19937_64* rng) const {
+    return slow_read_rate > 0 && SampleUnit(rng) < slow_read_rate;
+}
+
+int FaultProfile::SampleErrorCode(std::mt19937_64* rng) const {
+    if (error_rates.empty()) {
+        return 0;
+    }
+
+    double unit = SampleUnit(rng);
+    for (const auto& error : error_rates) {
+        if (unit < error.second) {
+            return error.first;
+        }
+        unit -= error.second;
+    }
+    return 0;
+}
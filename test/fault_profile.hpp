@@ -0,0 +1,61 @@
+#ifndef FAULT_PROFILE_
+#define FAULT_PROFILE_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+
+// Misbehavior HttpTestServer injects to reproduce a slow or failing server
+// offline. Loaded from a json file, for example:
+//
+//  {
+//    "seed": 42,
+//    "latency": {"distribution": "long_tail", "min_ms": 2, "max_ms": 2000,
+//                "shape": 1.5},
+//    "reset_rate": 0.001,
+//    "stall_rate": 0.0005,
+//    "slow_read": {"rate": 0.05, "bytes": 64, "interval_ms": 10},
+//    "error_rates": {"500": 0.01, "503": 0.02}
+//  }
+//
+// Every decision is drawn from a generator seeded with seed (plus the worker
+// index), so a scenario replays the same way against the same traffic.
+struct FaultProfile {
+    enum class Latency { None, Fixed, Uniform, LongTail };
+
+    uint64_t seed{0};
+    // fixed waits min, uniform draws from [min, max], long_tail draws from a
+    // Pareto distribution of the given shape starting at min, capped at max
+    Latency latency{Latency::None};
+    std::chrono::microseconds latency_min{0};
+    std::chrono::microseconds latency_max{0};
+    double latency_shape{1.5};
+    // share of requests answered by resetting the connection
+    double reset_rate{0};
+    // share of requests never answered, like a hung server node: their
+    // connection stays silent until the client gives up on it
+    double stall_rate{0};
+    // share of connections read slow_read_bytes at a time, slow_read_interval
+    // apart
+    double slow_read_rate{0};
+    size_t slow_read_bytes{64};
+    std::chrono::microseconds slow_read_interval{10000};
+    // share of requests answered with a status code instead of the mac based
+    // one
+    std::map<int, double> error_rates;
+
+    // Returns false if the file can not be read or holds an invalid profile
+    bool Load(const char* fname);
+    bool IsActive() const;
+
+    std::chrono::microseconds SampleLatency(std::mt19937_64* rng) const;
+    bool SampleReset(std::mt19937_64* rng) const;
+    bool SampleStall(std::mt19937_64* rng) const;
+    bool SampleSlowRead(std::mt19937_64* rng) const;
+    // 0 when the request gets its regular reply
+    int SampleErrorCode(std::mt19937_64* rng) const;
+};
+
+#endif  // FAULT_PROFILE_
@@ -0,0 +1,284 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "./http2_test_server.hpp"
+
+namespace {
+
+constexpr char kConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t kPrefaceSize = sizeof(kConnectionPreface) - 1;
+constexpr size_t kFrameHeaderSize = 9;
+
+enum FrameType : uint8_t {
+    Data = 0x0,
+    Headers = 0x1,
+    RstStream = 0x3,
+    Settings = 0x4,
+    Ping = 0x6,
+    GoAway = 0x7,
+    WindowUpdate = 0x8,
+};
+
+enum FrameFlag : uint8_t {
+    Ack = 0x1,
+    EndStream = 0x1,
+    EndHeaders = 0x4,
+};
+
+constexpr uint16_t kSettingsMaxConcurrentStreams = 0x3;
+
+bool ReadFully(int socket_fd, char* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t bytes = read(socket_fd, buffer + done, size - done);
+        if (bytes <= 0) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+void AppendUint32(std::string* out, uint32_t value) {
+    out->push_back(static_cast<char>((value >> 24) & 0xff));
+    out->push_back(static_cast<char>((value >> 16) & 0xff));
+    out->push_back(static_cast<char>((value >> 8) & 0xff));
+    out->push_back(static_cast<char>(value & 0xff));
+}
+
+// HPACK literal header field without indexing, name taken from the static
+// table (RFC 7541 6.2.2), value sent as a plain string. Values are short
+// enough to fit the 7 bit length prefix.
+void AppendLiteralHeader(std::string* out, uint8_t name_index,
+                         const std::string& value) {
+    out->push_back(static_cast<char>(0x0f));
+    out->push_back(static_cast<char>(name_index - 0x0f));
+    out->push_back(static_cast<char>(value.size()));
+    *out += value;
+}
+
+}  // namespace
+
+Http2TestServer::Http2TestServer(const std::string& ip_address, int port,
+                                 uint32_t max_concurrent_streams,
+                                 const std::string& reply_fname)
+    : max_concurrent_streams_(max_concurrent_streams) {
+    sock_addr_.sin_family = AF_INET;
+    sock_addr_.sin_port = htons(port);
+    sock_addr_.sin_addr.s_addr = inet_addr(ip_address.c_str());
+
+    std::ifstream input_file(reply_fname);
+    if (!input_file.is_open()) {
+        throw(std::runtime_error("Unable to read the h2c reply body!"));
+    }
+    std::stringstream file_stream;
+    file_stream << input_file.rdbuf();
+    reply_body_ = file_stream.str();
+
+    if (InitServer() < 0) {
+        throw(std::runtime_error("Unable to initialize h2c server!"));
+    }
+
+    WaitForConnections();
+}
+
+Http2TestServer::~Http2TestServer() {
+    StopServer();
+}
+
+int Http2TestServer::InitServer() {
+    server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd_ < 0) {
+        std::cout << "Error opening socket:" << errno << std::endl;
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) <
+        0) {
+        std::cout << "Error setting socket option:" << errno << std::endl;
+        StopServer();
+        return -1;
+    }
+
+    if (bind(server_fd_, reinterpret_cast<sockaddr*>(&sock_addr_),
+             sizeof(sock_addr_)) < 0) {
+        std::cout << "Error binding to socket:" << errno << std::endl;
+        StopServer();
+        return -1;
+    }
+
+    if (listen(server_fd_, kMaxConnectionNumber) < 0) {
+        std::cout << "Error listening to socket:" << errno << std::endl;
+        StopServer();
+        return -1;
+    }
+
+    return 0;
+}
+
+void Http2TestServer::StopServer() {
+    close(server_fd_);
+}
+
+void Http2TestServer::WaitForConnections() {
+    while (true) {
+        int new_socket = accept(server_fd_, nullptr, nullptr);
+        if (new_socket < 0) {
+            std::cout << "Error accepting connection:" << errno << std::endl;
+            return;
+        }
+
+        // one thread per connection, a flood of them is turned away
+        if (connections_.fetch_add(1) >= kMaxConnectionNumber) {
+            connections_--;
+            close(new_socket);
+            continue;
+        }
+        std::thread([this, new_socket] {
+            ServeConnection(new_socket);
+            connections_--;
+        }).detach();
+    }
+}
+
+void Http2TestServer::ServeConnection(int socket_fd) {
+    char preface[kPrefaceSize];
+    if (!ReadFully(socket_fd, preface, kPrefaceSize) ||
+        std::string(preface, kPrefaceSize) != kConnectionPreface) {
+        close(socket_fd);
+        return;
+    }
+
+    std::string settings;
+    settings.push_back(static_cast<char>(kSettingsMaxConcurrentStreams >> 8));
+    settings.push_back(static_cast<char>(kSettingsMaxConcurrentStreams));
+    AppendUint32(&settings, max_concurrent_streams_);
+    if (!SendFrame(socket_fd, FrameType::Settings, 0, 0, settings)) {
+        close(socket_fd);
+        return;
+    }
+
+    char header[kFrameHeaderSize];
+    std::string payload;
+    while (ReadFully(socket_fd, header, kFrameHeaderSize)) {
+        auto* bytes = reinterpret_cast<unsigned char*>(header);
+        uint32_t length = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+        uint8_t type = bytes[3];
+        uint8_t flags = bytes[4];
+        uint32_t stream_id = ((bytes[5] & 0x7f) << 24) | (bytes[6] << 16) |
+                             (bytes[7] << 8) | bytes[8];
+
+        payload.resize(length);
+        if (length > 0 && !ReadFully(socket_fd, &payload[0], length)) {
+            break;
+        }
+
+        bool ok = true;
+        switch (type) {
+            case FrameType::Settings:
+                if (!(flags & FrameFlag::Ack)) {
+                    ok = SendFrame(socket_fd, FrameType::Settings,
+                                   FrameFlag::Ack, 0, "");
+                }
+                break;
+
+            case FrameType::Ping:
+                if (!(flags & FrameFlag::Ack)) {
+                    ok = SendFrame(socket_fd, FrameType::Ping, FrameFlag::Ack,
+                                   0, payload);
+                }
+                break;
+
+            // requests without a body end on the header block
+            case FrameType::Headers:
+                if (flags & FrameFlag::EndStream) {
+                    ok = SendReply(socket_fd, stream_id);
+                }
+                break;
+
+            case FrameType::Data: {
+                // hand the consumed bytes back so the uploads keep flowing
+                if (length > 0) {
+                    std::string increment;
+                    AppendUint32(&increment, length);
+                    ok = SendFrame(socket_fd, FrameType::WindowUpdate, 0, 0,
+                                   increment) &&
+                         SendFrame(socket_fd, FrameType::WindowUpdate, 0,
+                                   stream_id, increment);
+                }
+                if (ok && (flags & FrameFlag::EndStream)) {
+                    ok = SendReply(socket_fd, stream_id);
+                }
+                break;
+            }
+
+            case FrameType::GoAway:
+                ok = false;
+                break;
+
+            // priority, rst stream, window update and continuation frames
+            // carry nothing this server needs
+            default:
+                break;
+        }
+
+        if (!ok) {
+            break;
+        }
+    }
+
+    close(socket_fd);
+}
+
+bool Http2TestServer::SendFrame(int socket_fd, uint8_t type, uint8_t flags,
+                                uint32_t stream_id,
+                                const std::string& payload) {
+    std::string frame;
+    frame.reserve(kFrameHeaderSize + payload.size());
+    frame.push_back(static_cast<char>((payload.size() >> 16) & 0xff));
+    frame.push_back(static_cast<char>((payload.size() >> 8) & 0xff));
+    frame.push_back(static_cast<char>(payload.size() & 0xff));
+    frame.push_back(static_cast<char>(type));
+    frame.push_back(static_cast<char>(flags));
+    AppendUint32(&frame, stream_id & 0x7fffffff);
+    frame += payload;
+
+    size_t done = 0;
+    while (done < frame.size()) {
+        ssize_t bytes = write(socket_fd, frame.data() + done,
+                              frame.size() - done);
+        if (bytes < 0) {
+            std::cout << "Error writing to socket:" << errno << std::endl;
+            return false;
+        }
+        done += bytes;
+    }
+
+    return true;
+}
+
+bool Http2TestServer::SendReply(int socket_fd, uint32_t stream_id) {
+    constexpr uint8_t kStatus200 = 0x88;  // static table entry 8
+    constexpr uint8_t kContentLength = 28;
+    constexpr uint8_t kContentType = 31;
+
+    std::string block;
+    block.push_back(static_cast<char>(kStatus200));
+    AppendLiteralHeader(&block, kContentType, "application/json");
+    AppendLiteralHeader(&block, kContentLength,
+                        std::to_string(reply_body_.size()));
+
+    return SendFrame(socket_fd, FrameType::Headers, FrameFlag::EndHeaders,
+                     stream_id, block) &&
+           SendFrame(socket_fd, FrameType::Data, FrameFlag::EndStream,
+                     stream_id, reply_body_);
+}
@@ -0,0 +1,45 @@
+#ifndef HTTP2_TEST_SERVER_
+#define HTTP2_TEST_SERVER_
+
+#include <netinet/in.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Minimal h2c (HTTP/2 over cleartext, prior knowledge) stand-in used to test
+// the multiplexed mode of the updater offline. Every stream is answered with
+// a 200 carrying the body read from reply_fname. Request headers are not HPACK
+// decoded, so the mac based error codes of HttpTestServer are not available
+// here.
+//
+// Unlike HttpTestServer there is no epoll loop: every connection is served by
+// a detached, blocking thread of its own, up to kMaxConnectionNumber at once,
+// the connections past that are closed as soon as they are accepted. The
+// constructor serves until the process exits, the threads are never stopped,
+// so the server is only meant for a handful of test connections.
+class Http2TestServer {
+ public:
+    Http2TestServer(const std::string& ip_address, int port,
+                    uint32_t max_concurrent_streams,
+                    const std::string& reply_fname);
+    ~Http2TestServer();
+
+ private:
+    int InitServer();
+    void StopServer();
+    void WaitForConnections();
+    void ServeConnection(int socket_fd);
+    bool SendFrame(int socket_fd, uint8_t type, uint8_t flags,
+                   uint32_t stream_id, const std::string& payload);
+    bool SendReply(int socket_fd, uint32_t stream_id);
+
+    struct sockaddr_in sock_addr_;
+    int server_fd_;
+    uint32_t max_concurrent_streams_;
+    std::string reply_body_;
+    // connections with a thread serving them
+    std::atomic<uint32_t> connections_{0};
+    static constexpr uint32_t kMaxConnectionNumber = 128;
+};
+
+#endif  // HTTP2_TEST_SERVER_
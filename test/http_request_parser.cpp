@@ -0,0 +1,165 @@
+#include <strings.h>
+#include <cstdint>
+
+#include "./http_request_parser.hpp"
+
+namespace {
+
+constexpr std::string_view kHeaderEnd = "\r\n\r\n";
+constexpr std::string_view kLineEnd = "\r\n";
+
+bool EqualsIgnoreCase(std::string_view text, std::string_view expected) {
+    return text.size() == expected.size() &&
+           strncasecmp(text.data(), expected.data(), text.size()) == 0;
+}
+
+std::string_view Trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Splits "a SP b" at the first space, returns false if there is none
+bool SplitAtSpace(std::string_view* rest, std::string_view* token) {
+    size_t space = rest->find(' ');
+    if (space == 0 || space == std::string_view::npos) {
+        return false;
+    }
+    *token = rest->substr(0, space);
+    rest->remove_prefix(space + 1);
+    return true;
+}
+
+bool ParseContentLength(std::string_view value, size_t* length) {
+    if (value.empty()) {
+        return false;
+    }
+    size_t result = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9' || result > (SIZE_MAX - 9) / 10) {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    *length = result;
+    return true;
+}
+
+}  // namespace
+
+constexpr size_t HttpRequestParser::kMaxHeaders;
+constexpr size_t HttpRequestParser::kMaxHeaderSize;
+
+HttpRequestParser::Status HttpRequestParser::Parse(std::string_view data,
+                                                   Request* request) {
+    bool parsed_now = false;
+    if (header_size_ == 0) {
+        // the end marker may straddle the bytes scanned by the last call
+        size_t from = scanned_ >= kHeaderEnd.size() - 1
+                          ? scanned_ - (kHeaderEnd.size() - 1)
+                          : 0;
+        size_t header_end = data.find(kHeaderEnd, from);
+        if (header_end == std::string_view::npos) {
+            scanned_ = data.size();
+            return data.size() > kMaxHeaderSize ? Status::Invalid
+                                                : Status::Incomplete;
+        }
+
+        header_size_ = header_end + kHeaderEnd.size();
+        Status status = ParseHeaders(data, request);
+        if (status != Status::Complete) {
+            Reset();
+            return status;
+        }
+        content_length_ = request->body.size();
+        parsed_now = true;
+    }
+
+    if (data.size() - header_size_ < content_length_) {
+        return parsed_now && request->expect_continue ? Status::Continue
+                                                      : Status::Incomplete;
+    }
+
+    // the headers are read again only for a body that needed more reads, the
+    // views of the earlier call may point into a buffer that has moved since
+    if (!parsed_now) {
+        ParseHeaders(data, request);
+    }
+    Reset();
+    return Status::Complete;
+}
+
+void HttpRequestParser::Reset() {
+    scanned_ = 0;
+    header_size_ = 0;
+    content_length_ = 0;
+}
+
+// Fills request from the header_size_ bytes of headers at the front of
+// data. The body view gets its final length even if data is still short.
+HttpRequestParser::Status HttpRequestParser::ParseHeaders(
+    std::string_view data, Request* request) const {
+    std::string_view headers =
+        data.substr(0, header_size_ - kHeaderEnd.size());
+
+    size_t line_end = headers.find(kLineEnd);
+    std::string_view line = headers.substr(0, line_end);
+    if (!SplitAtSpace(&line, &request->method) ||
+        !SplitAtSpace(&line, &request->target) ||
+        line.compare(0, 5, "HTTP/") != 0) {
+        return Status::Invalid;
+    }
+    request->version = line;
+
+    // HTTP/1.1 keeps the connection unless asked not to, 1.0 the other way
+    request->keep_alive = request->version == "HTTP/1.1";
+    request->expect_continue = false;
+    request->header_count = 0;
+    size_t content_length = 0;
+
+    while (line_end != std::string_view::npos) {
+        size_t start = line_end + kLineEnd.size();
+        line_end = headers.find(kLineEnd, start);
+        line = headers.substr(start, line_end == std::string_view::npos
+                                         ? std::string_view::npos
+                                         : line_end - start);
+
+        size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos ||
+            request->header_count == kMaxHeaders) {
+            return Status::Invalid;
+        }
+
+        Header& header = request->headers[request->header_count++];
+        header.name = line.substr(0, colon);
+        header.value = Trim(line.substr(colon + 1));
+        if (EqualsIgnoreCase(header.name, "Content-Length")) {
+            if (!ParseContentLength(header.value, &content_length)) {
+                return Status::Invalid;
+            }
+        } else if (EqualsIgnoreCase(header.name, "Transfer-Encoding")) {
+            // chunked bodies are not sent by the updater
+            return Status::Invalid;
+        } else if (EqualsIgnoreCase(header.name, "Connection")) {
+            if (EqualsIgnoreCase(header.value, "close")) {
+                request->keep_alive = false;
+            } else if (EqualsIgnoreCase(header.value, "keep-alive")) {
+                request->keep_alive = true;
+            }
+        } else if (EqualsIgnoreCase(header.name, "Expect")) {
+            // an HTTP/1.0 client does not wait for the interim reply
+            request->expect_continue =
+                EqualsIgnoreCase(header.value, "100-continue") &&
+                request->version == "HTTP/1.1";
+        }
+    }
+
+    request->body = std::string_view(data.data() + header_size_,
+                                     content_length);
+    request->size = header_size_ + content_length;
+    return Status::Complete;
+}
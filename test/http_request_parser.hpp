@@ -0,0 +1,59 @@
+#ifndef HTTP_REQUEST_PARSER_
+#define HTTP_REQUEST_PARSER_
+
+#include <cstddef>
+#include <string_view>
+
+// Incremental HTTP/1.1 request parser in the spirit of picohttpparser. It is
+// handed everything received so far from the start of a request and returns
+// views into those bytes, nothing is copied. While the request is incomplete
+// it remembers how far it got, so a request arriving in many reads is not
+// scanned again from the start, and once the headers are complete it only
+// waits for Content-Length bytes of body. Pipelined requests are parsed one
+// after the other from the same buffer.
+class HttpRequestParser {
+ public:
+    // Continue is Incomplete for a request whose headers just came with
+    // "Expect: 100-continue", the client holds its body back until the
+    // server answers "100 Continue". It is returned once per request.
+    enum Status { Complete = 0, Incomplete = 1, Continue = 2, Invalid = -1 };
+
+    static constexpr size_t kMaxHeaders = 32;
+    // a request whose headers do not end within this many bytes is refused
+    static constexpr size_t kMaxHeaderSize = 64 * 1024;
+
+    struct Header {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    struct Request {
+        std::string_view method;
+        std::string_view target;
+        std::string_view version;
+        Header headers[kMaxHeaders];
+        size_t header_count;
+        std::string_view body;
+        bool keep_alive;
+        bool expect_continue;
+        // bytes taken by the whole request, body included
+        size_t size;
+    };
+
+    // Parses the request at the front of data. The views in request point
+    // into data and are only set when Complete is returned.
+    Status Parse(std::string_view data, Request* request);
+    // Forgets a partially parsed request, for a new connection
+    void Reset();
+
+ private:
+    Status ParseHeaders(std::string_view data, Request* request) const;
+
+    // bytes already searched for the end of the headers
+    size_t scanned_{0};
+    // set once the headers of the current request are complete
+    size_t header_size_{0};
+    size_t content_length_{0};
+};
+
+#endif  // HTTP_REQUEST_PARSER_
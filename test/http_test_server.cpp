@@ -1,112 +1,513 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <queue>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 #include "../include/json.hpp"
 #include "./http_test_server.hpp"
 
-HttpTestServer::HttpTestServer(const std::string& ip_address, int port) {
+namespace {
+
+constexpr size_t kReadChunkSize = 16 * 1024;
+constexpr int kMaxEvents = 256;
+// tells a client waiting on "Expect: 100-continue" to send its body
+const std::string kContinueReply = "HTTP/1.1 100 Continue\r\n\r\n";
+
+using Clock = std::chrono::steady_clock;
+// when a connection has something to do, and which one
+using Timer = std::pair<Clock::time_point, uint64_t>;
+
+}  // namespace
+
+struct HttpTestServer::Connection {
+    Connection(int fd, uint64_t id) : fd(fd), id(id) {}
+
+    int fd;
+    uint64_t id;
+    // bytes received, requests are parsed in place from input_offset on
+    std::string input;
+    size_t input_offset{0};
+    HttpRequestParser parser;
+    // replies waiting for the socket, mostly the canned buffers themselves
+    std::vector<iovec> pending;
+    size_t next_pending{0};
+    // replies held back by the latency profile, due in request order
+    std::deque<std::pair<Clock::time_point, const std::string*>> delayed;
+    // replies built for this connection, kept until they are written
+    std::deque<std::string> owned;
+    bool close_after_write{false};
+    bool waiting_for_write{false};
+    // a slow reader takes a few bytes and then stops reading for a while
+    bool slow_read{false};
+    bool read_paused{false};
+    Clock::time_point resume_read;
+    // closes with a RST instead of a FIN
+    bool reset{false};
+    // stopped answering, see FaultProfile::stall_rate
+    bool stalled{false};
+    uint32_t events{EPOLLIN};
+};
+
+// The state of one epoll loop, only its own thread touches it
+struct HttpTestServer::Worker {
+    int epoll_fd;
+    std::mt19937_64 rng;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    // timers outlive their connections, they find them by id
+    std::unordered_map<uint64_t, Connection*> connections;
+    uint64_t next_id{0};
+};
+
+HttpTestServer::HttpTestServer(const std::string& ip_address, int port,
+                               uint32_t workers, const FaultProfile& faults)
+    : workers_(std::max<uint32_t>(workers, 1)), faults_(faults) {
     sock_addr_.sin_family = AF_INET;
     sock_addr_.sin_port = htons(port);
     sock_addr_.sin_addr.s_addr = inet_addr(ip_address.c_str());
 
+    LoadReplies();
     if (InitServer() < 0) {
         throw(std::runtime_error("Unable to initialize socket server!"));
     }
 
-    WaitForConnections();
+    // the constructor serves with the first socket, the other workers get a
+    // thread each
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < server_fds_.size(); i++) {
+        threads.emplace_back(&HttpTestServer::WaitForConnections, this, i);
+    }
+    WaitForConnections(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
 }
 
 HttpTestServer::~HttpTestServer() {
     StopServer();
 }
 
-void HttpTestServer::ListenForConnections() {
-    int status = listen(server_fd_, kMaxConnectionNumber);
-    if (listen(server_fd_, kMaxConnectionNumber) < 0) {
-        std::cout << "Error listening to socket:" << errno << std::endl;
-        StopServer();
+int HttpTestServer::InitServer() {
+    for (uint32_t i = 0; i < workers_; i++) {
+        int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (server_fd < 0) {
+            std::cout << "Error opening socket:" << errno << std::endl;
+            StopServer();
+            return -1;
+        }
+        server_fds_.push_back(server_fd);
+
+        // one listening socket per worker, the kernel balances between them
+        int opt = 1;
+        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
+                       sizeof(opt)) < 0 ||
+            setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt,
+                       sizeof(opt)) < 0) {
+            std::cout << "Error setting socket option:" << errno << std::endl;
+            StopServer();
+            return -1;
+        }
+
+        if (bind(server_fd, reinterpret_cast<sockaddr*>(&sock_addr_),
+                 sizeof(sock_addr_)) < 0) {
+            std::cout << "Error binding to socket:" << errno << std::endl;
+            StopServer();
+            return -1;
+        }
+
+        if (listen(server_fd, kListenBacklog) < 0) {
+            std::cout << "Error listening to socket:" << errno << std::endl;
+            StopServer();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void HttpTestServer::StopServer() {
+    for (int server_fd : server_fds_) {
+        close(server_fd);
+    }
+    server_fds_.clear();
+}
+
+void HttpTestServer::WaitForConnections(uint32_t worker_index) {
+    int server_fd = server_fds_[worker_index];
+    Worker worker;
+    worker.epoll_fd = epoll_create1(0);
+    if (worker.epoll_fd < 0) {
+        std::cout << "Error creating epoll instance:" << errno << std::endl;
         return;
     }
+    // every worker draws its own reproducible sequence of faults
+    worker.rng.seed(faults_.seed + worker_index);
+
+    // the listening socket is the only entry without a connection
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, server_fd, &event);
+
+    epoll_event events[kMaxEvents];
+    while (true) {
+        int count = epoll_wait(worker.epoll_fd, events, kMaxEvents,
+                               GetTimerTimeout(worker));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << "Error waiting for events:" << errno << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            Connection* connection =
+                static_cast<Connection*>(events[i].data.ptr);
+            if (connection == nullptr) {
+                AcceptConnections(&worker, server_fd);
+                continue;
+            }
+
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+                ((events[i].events & EPOLLIN) &&
+                 !ReadRequests(&worker, connection)) ||
+                !WriteReplies(&worker, connection)) {
+                CloseConnection(&worker, connection);
+            }
+        }
+
+        RunTimers(&worker);
+    }
+
+    close(worker.epoll_fd);
 }
 
-int HttpTestServer::InitServer() {
-    server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd_ < 0) {
-        std::cout << "Error opening socket:" << errno << std::endl;
-        return -1;
+void HttpTestServer::AcceptConnections(Worker* worker, int server_fd) {
+    while (true) {
+        int new_socket = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (new_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cout << "Error accepting connection:" << errno
+                          << std::endl;
+            }
+            return;
+        }
+
+        int opt = 1;
+        setsockopt(new_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        Connection* connection = new Connection(new_socket, worker->next_id++);
+        connection->slow_read = faults_.SampleSlowRead(&worker->rng);
+        worker->connections[connection->id] = connection;
+
+        epoll_event event = {};
+        event.events = connection->events;
+        event.data.ptr = connection;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, new_socket, &event);
     }
+}
 
-    int opt = 1;
-    if (setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) <
-        0) {
-        std::cout << "Error setting socket option:" << errno << std::endl;
-        StopServer();
-        return -1;
+// Reads what the socket has and queues a reply for every complete request.
+// Returns false once the connection has to be closed.
+bool HttpTestServer::ReadRequests(Worker* worker, Connection* connection) {
+    char buffer[kReadChunkSize];
+    size_t chunk_size = connection->slow_read
+                            ? std::min(faults_.slow_read_bytes, kReadChunkSize)
+                            : kReadChunkSize;
+    bool peer_closed = false;
+    while (true) {
+        ssize_t bytes = read(connection->fd, buffer, chunk_size);
+        if (bytes > 0) {
+            connection->input.append(buffer, bytes);
+            if (!connection->slow_read) {
+                continue;
+            }
+
+            // the rest waits in the socket until the timer resumes reading
+            connection->read_paused = true;
+            connection->resume_read = Clock::now() + faults_.slow_read_interval;
+            worker->timers.push({connection->resume_read, connection->id});
+            UpdateEvents(worker, connection);
+            break;
+        }
+        if (bytes == 0) {
+            peer_closed = true;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        break;
     }
 
-    if (bind(server_fd_, reinterpret_cast<sockaddr*>(&sock_addr_),
-             sizeof(sock_addr_)) < 0) {
-        std::cout << "Error binding to socket:" << errno << std::endl;
-        StopServer();
-        return -1;
+    // nothing more is answered, the connection goes once the client left
+    if (connection->stalled) {
+        connection->input.clear();
+        connection->input_offset = 0;
+        return !peer_closed;
     }
 
-    return 0;
+    HttpRequestParser::Request request;
+    while (!connection->close_after_write) {
+        std::string_view unparsed(connection->input);
+        unparsed.remove_prefix(connection->input_offset);
+        HttpRequestParser::Status status =
+            connection->parser.Parse(unparsed, &request);
+        if (status == HttpRequestParser::Status::Invalid) {
+            return false;
+        }
+        if (status == HttpRequestParser::Status::Incomplete) {
+            break;
+        }
+        if (status == HttpRequestParser::Status::Continue) {
+            // never ahead of the replies to the requests before it
+            if (connection->delayed.empty()) {
+                connection->pending.push_back(
+                    {const_cast<char*>(kContinueReply.data()),
+                     kContinueReply.size()});
+            } else {
+                connection->delayed.emplace_back(
+                    connection->delayed.back().first, &kContinueReply);
+            }
+            break;
+        }
+        connection->input_offset += request.size;
+        connection->close_after_write = !request.keep_alive;
+
+        if (faults_.SampleReset(&worker->rng)) {
+            connection->reset = true;
+            return false;
+        }
+        if (faults_.SampleStall(&worker->rng)) {
+            connection->stalled = true;
+            break;
+        }
+
+        const std::string* reply = SelectReply(worker, connection, request);
+        if (reply == nullptr) {
+            return false;
+        }
+        QueueReply(worker, connection, reply);
+    }
+
+    // answered requests are dropped when the buffer is empty, or moved out
+    // once they take more room than a read adds
+    if (connection->input_offset == connection->input.size()) {
+        connection->input.clear();
+        connection->input_offset = 0;
+    } else if (connection->input_offset > kReadChunkSize) {
+        connection->input.erase(0, connection->input_offset);
+        connection->input_offset = 0;
+    }
+
+    // a client that stopped sending still gets the replies it asked for
+    if (peer_closed) {
+        connection->close_after_write = true;
+    }
+    return true;
 }
 
-void HttpTestServer::StopServer() {
-    close(server_fd_);
+const std::string* HttpTestServer::SelectReply(
+    Worker* worker, Connection* connection,
+    const HttpRequestParser::Request& request) {
+    // the token endpoint is left alone, the updater can not start without it
+    if (IsTokenRequest(request)) {
+        connection->owned.emplace_back();
+        BuildTokenReply(&connection->owned.back());
+        return &connection->owned.back();
+    }
+
+    int code = faults_.SampleErrorCode(&worker->rng);
+    if (code == 0) {
+        code = GetTestErrCode(request.target);
+    }
+    auto canned = canned_replies_.find(code);
+    if (canned == canned_replies_.end()) {
+        return nullptr;
+    }
+    return &canned->second;
 }
 
-void HttpTestServer::WaitForConnections() {
-    // std::cout << "----- WaitForConnections -----" << std::endl;
+void HttpTestServer::QueueReply(Worker* worker, Connection* connection,
+                                const std::string* reply) {
+    std::chrono::microseconds latency = faults_.SampleLatency(&worker->rng);
+    if (latency.count() == 0 && connection->delayed.empty()) {
+        connection->pending.push_back(
+            {const_cast<char*>(reply->data()), reply->size()});
+        return;
+    }
 
-    ListenForConnections();
+    // a pipelined reply never overtakes the one before it
+    Clock::time_point due = Clock::now() + latency;
+    if (!connection->delayed.empty()) {
+        due = std::max(due, connection->delayed.back().first);
+    }
+    connection->delayed.emplace_back(due, reply);
+    worker->timers.push({due, connection->id});
+}
 
-    int bytes;
-    int addrlen = sizeof(sock_addr_);
-    constexpr uint32_t kBufferSize = 1024 * 10;  // 10 kbytes
-    std::shared_ptr<char[]> buffer(new char[kBufferSize]);
+// Resumes the slow readers and releases the delayed replies that are due
+void HttpTestServer::RunTimers(Worker* worker) {
+    Clock::time_point now = Clock::now();
+    while (!worker->timers.empty() && worker->timers.top().first <= now) {
+        uint64_t id = worker->timers.top().second;
+        worker->timers.pop();
+        auto found = worker->connections.find(id);
+        if (found == worker->connections.end()) {
+            continue;
+        }
 
-    while (true) {
-        int new_socket =
-            accept(server_fd_, reinterpret_cast<sockaddr*>(&sock_addr_),
-                   reinterpret_cast<socklen_t*>(&addrlen));
+        Connection* connection = found->second;
+        if (connection->read_paused && connection->resume_read <= now) {
+            connection->read_paused = false;
+            UpdateEvents(worker, connection);
+        }
+        while (!connection->delayed.empty() &&
+               connection->delayed.front().first <= now) {
+            const std::string* reply = connection->delayed.front().second;
+            connection->pending.push_back(
+                {const_cast<char*>(reply->data()), reply->size()});
+            connection->delayed.pop_front();
+        }
+        if (!WriteReplies(worker, connection)) {
+            CloseConnection(worker, connection);
+        }
+    }
+}
 
-        bytes = read(new_socket, buffer.get(), kBufferSize);
+// Milliseconds epoll_wait may sleep before the next timer is due
+int HttpTestServer::GetTimerTimeout(const Worker& worker) {
+    if (worker.timers.empty()) {
+        return -1;
+    }
+
+    auto wait = worker.timers.top().first - Clock::now();
+    if (wait.count() <= 0) {
+        return 0;
+    }
+    // rounded up, waking early would only spin until the timer is due
+    return static_cast<int>(
+        std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+}
+
+// Writes as much of the pending replies as the socket takes and waits for
+// EPOLLOUT when it is full. Returns false once the connection is done.
+bool HttpTestServer::WriteReplies(Worker* worker, Connection* connection) {
+    std::vector<iovec>& pending = connection->pending;
+    while (connection->next_pending < pending.size()) {
+        // every reply queued by one read goes out in a single writev
+        int count = static_cast<int>(std::min<size_t>(
+            pending.size() - connection->next_pending, IOV_MAX));
+        ssize_t bytes = writev(connection->fd,
+                               &pending[connection->next_pending], count);
         if (bytes < 0) {
-            close(new_socket);
-            std::cout << "Error reading from socket:" << errno << std::endl;
-            StopServer();
-            return;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+
+            if (!connection->waiting_for_write) {
+                connection->waiting_for_write = true;
+                UpdateEvents(worker, connection);
+            }
+            return true;
         }
 
-        // std::cout << " = = = = = = = = Received: = = = = = = = =" << std::endl;
-        // std::cout << buffer.get() << std::endl;
+        // skip what was written, a reply may be left half sent
+        while (bytes > 0) {
+            iovec& next = pending[connection->next_pending];
+            size_t done = std::min<size_t>(bytes, next.iov_len);
+            next.iov_base = static_cast<char*>(next.iov_base) + done;
+            next.iov_len -= done;
+            bytes -= done;
+            if (next.iov_len == 0) {
+                connection->next_pending++;
+            }
+        }
+    }
+
+    pending.clear();
+    connection->next_pending = 0;
+    if (connection->waiting_for_write) {
+        connection->waiting_for_write = false;
+        UpdateEvents(worker, connection);
+    }
 
-        int code = GetTestErrCode(std::string(buffer.get()));
+    // the delayed replies may still point into the owned ones
+    if (!connection->delayed.empty()) {
+        return true;
+    }
+    connection->owned.clear();
+    return !connection->close_after_write;
+}
+
+void HttpTestServer::UpdateEvents(Worker* worker, Connection* connection) {
+    uint32_t events = 0;
+    if (!connection->read_paused) {
+        events |= EPOLLIN;
+    }
+    if (connection->waiting_for_write) {
+        events |= EPOLLOUT;
+    }
+    if (events == connection->events) {
+        return;
+    }
+
+    epoll_event event = {};
+    event.events = events;
+    event.data.ptr = connection;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+}
+
+void HttpTestServer::CloseConnection(Worker* worker, Connection* connection) {
+    if (connection->reset) {
+        // a zero linger time turns close() into a RST
+        linger reset = {1, 0};
+        setsockopt(connection->fd, SOL_SOCKET, SO_LINGER, &reset,
+                   sizeof(reset));
+    }
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+    worker->connections.erase(connection->id);
+    delete connection;
+}
+
+// Every reply the code map can ask for is built once, the workers only
+// queue a pointer to it
+void HttpTestServer::LoadReplies() {
+    std::vector<int> codes = {200};
+    for (const auto& code : code_map_) {
+        codes.push_back(code.second);
+    }
+    for (const auto& error : faults_.error_rates) {
+        codes.push_back(error.first);
+    }
 
+    for (int code : codes) {
         std::string reply;
-        if (BuildHttpReply(code, &reply) == 0) {
-            bytes = write(new_socket, reply.c_str(), reply.size());
-            if (bytes < 0) {
-                close(new_socket);
-                std::cout << "Error writing to socket:" << errno << std::endl;
-                StopServer();
-                return;
-            }
+        if (BuildHttpReply(code, &reply) == 0 ||
+            BuildErrorReply(code, &reply) == 0) {
+            canned_replies_[code] = std::move(reply);
+        } else {
+            std::cout << "Missing reply for the code " << code << std::endl;
         }
-
-        close(new_socket);
     }
 }
 
@@ -150,17 +551,62 @@ int HttpTestServer::BuildHttpReply(int err_code, std::string* reply) {
     return -1;
 }
 
-int HttpTestServer::GetTestErrCode(const std::string& request_content) {
-    std::istringstream str_stream(request_content);
-    std::string first_line;
-    getline(str_stream, first_line);
-    std::size_t pos = first_line.find("clientId:");
-    std::string mac_first_octet =
-        first_line.substr(pos + strlen("clientId:"), 2);
+int HttpTestServer::BuildErrorReply(int err_code, std::string* reply) {
+    static const std::map<int, const char*> kReasons = {
+        {400, "Bad Request"},         {401, "Unauthorized"},
+        {403, "Forbidden"},           {404, "Not Found"},
+        {408, "Request Timeout"},     {409, "Conflict"},
+        {429, "Too Many Requests"},   {500, "Internal Server Error"},
+        {502, "Bad Gateway"},         {503, "Service Unavailable"},
+        {504, "Gateway Timeout"}};
+    auto reason = kReasons.find(err_code);
+    std::string error = reason != kReasons.end() ? reason->second : "Error";
+
+    // the same shape as the files in test/headers
+    nlohmann::json json;
+    json["statusCode"] = err_code;
+    json["error"] = error;
+    json["message"] = "Injected by the fault profile";
+    std::string body = json.dump(2);
 
-    if (code_map_.count(mac_first_octet.c_str())) {
-        return code_map_[mac_first_octet.c_str()];
+    *reply = std::string("HTTP/1.1 ") + std::to_string(err_code) + " " +
+             error + "\nContent-Type: application/json\nContent-Length:" +
+             std::to_string(body.size()) + std::string("\n\n") + body;
+    return 0;
+}
+
+bool HttpTestServer::IsTokenRequest(
+    const HttpRequestParser::Request& request) {
+    return request.method == "POST" && request.target == "/token";
+}
+
+int HttpTestServer::BuildTokenReply(std::string* reply) {
+    // a new token on every request, the tests tell them apart
+    nlohmann::json json;
+    json["access_token"] = "test-token-" + std::to_string(++issued_tokens_);
+    json["token_type"] = "Bearer";
+    json["expires_in"] = kTokenLifetime;
+    std::string body = json.dump();
+
+    *reply = std::string(
+                 "HTTP/1.1 200 OK\nContent-Type: "
+                 "application/json\nContent-Length:") +
+             std::to_string(body.size()) + std::string("\n\n") + body;
+    return 0;
+}
+
+int HttpTestServer::GetTestErrCode(std::string_view target) {
+    std::size_t pos = target.find("clientId:");
+    if (pos == std::string_view::npos) {
+        return 200;
+    }
+    std::string mac_first_octet(target.substr(pos + strlen("clientId:"), 2));
+
+    // find, several workers look up the map at once
+    auto code = code_map_.find(mac_first_octet.c_str());
+    if (code != code_map_.end()) {
+        return code->second;
     }
 
     return 200;
-}
\ No newline at end of file
+}
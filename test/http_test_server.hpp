@@ -4,9 +4,22 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <atomic>
 #include <map>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "./fault_profile.hpp"
+#include "./http_request_parser.hpp"
+
+// HTTP/1.1 stand-in for the profile server. Every worker thread runs its own
+// epoll loop over its own SO_REUSEPORT listening socket, so the kernel
+// spreads the connections between the workers, and keeps the connections
+// alive between requests. The constructor serves until the process exits.
+// A fault profile makes it answer late, reset connections, read slowly or
+// fail requests; the waits are timers of the worker loop, a delayed reply
+// never holds up the other connections.
 class HttpTestServer {
  public:
     struct cmp_str {
@@ -15,20 +28,47 @@ class HttpTestServer {
         }
     };
 
-    HttpTestServer(const std::string& ip_address, int port);
+    HttpTestServer(const std::string& ip_address, int port,
+                   uint32_t workers = 1,
+                   const FaultProfile& faults = FaultProfile());
     ~HttpTestServer();
 
  private:
+    struct Connection;
+    struct Worker;
+
     int InitServer();
     void StopServer();
+    void LoadReplies();
     int BuildHttpReply(int err_code, std::string* reply);
-    void ListenForConnections();
-    void WaitForConnections();
-    int GetTestErrCode(const std::string& request_content);
+    // for the injected codes without a file in test/headers
+    int BuildErrorReply(int err_code, std::string* reply);
+    void WaitForConnections(uint32_t worker_index);
+    void AcceptConnections(Worker* worker, int server_fd);
+    bool ReadRequests(Worker* worker, Connection* connection);
+    const std::string* SelectReply(Worker* worker, Connection* connection,
+                                   const HttpRequestParser::Request& request);
+    void QueueReply(Worker* worker, Connection* connection,
+                    const std::string* reply);
+    void RunTimers(Worker* worker);
+    int GetTimerTimeout(const Worker& worker);
+    bool WriteReplies(Worker* worker, Connection* connection);
+    void UpdateEvents(Worker* worker, Connection* connection);
+    void CloseConnection(Worker* worker, Connection* connection);
+    int GetTestErrCode(std::string_view target);
+    // stand-in token endpoint, POST /token
+    bool IsTokenRequest(const HttpRequestParser::Request& request);
+    int BuildTokenReply(std::string* reply);
 
     struct sockaddr_in sock_addr_;
-    int server_fd_;
-    static constexpr uint32_t kMaxConnectionNumber = 5;
+    uint32_t workers_;
+    std::vector<int> server_fds_;
+    FaultProfile faults_;
+    static constexpr int kListenBacklog = SOMAXCONN;
+    static constexpr uint32_t kTokenLifetime = 3600;
+    std::atomic<uint32_t> issued_tokens_{0};
+    // ready to send replies by status code, read only once serving starts
+    std::map<int, std::string> canned_replies_;
     // HARDCODE error codes to test my content
     std::map<const char*, int, cmp_str> code_map_ = {{"b1", 401},
                                                      {"b2", 404},
@@ -36,4 +76,4 @@ class HttpTestServer {
                                                      {"b4", 500}};
 };
 
-#endif  // HTTP_TEST_SERVER_
\ No newline at end of file
+#endif  // HTTP_TEST_SERVER_
@@ -1,21 +1,44 @@
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
+#include "fault_profile.hpp"
+#include "http2_test_server.hpp"
 #include "http_test_server.hpp"
 
+// relative to the build directory, like the HTTP/1.1 replies
+constexpr char kH2cReplyBody[] = "../test/headers/200.txt";
+
 static void ShowHelp() {
-    std::cout << "Usage: ./htpp_server [-h] [-i <ip>] [-p <port>] \n"
+    std::cout << "Usage: ./htpp_server [-h] [-i <ip>] [-p <port>] [-2 {0|1}] "
+                 "[-s <count>] [-w <count>] [-f <file>] [-b <file>]\n"
               << "\t-h,--help\tShow this help message\n"
               << "\t-i,--ip-addr\tThe IP address to which the server will "
                  "bind. Default is 0.0.0.0\n"
               << "\t-p,--port\tHTTP server port number. Default is 8080\n"
+              << "\t-2,--http2\tServe h2c (HTTP/2 prior knowledge) instead "
+                 "of HTTP/1.1\n"
+              << "\t-s,--max-streams\tConcurrent streams advertised per "
+                 "HTTP/2 connection. Default is 100\n"
+              << "\t-w,--workers\tHTTP/1.1 worker threads, each with its "
+                 "own epoll loop. Default is the number of cores\n"
+              << "\t-f,--fault-profile\tJson file with the latency, reset, "
+                 "slow read and error rates of the HTTP/1.1 server\n"
+              << "\t-b,--reply-body\tBody of the HTTP/2 replies. Default is "
+              << kH2cReplyBody << "\n"
               << std::endl;
 }
 
 int main(int argc, char* argv[]) {
     int port = 8080;
     std::string ip_addr{"0.0.0.0"};
+    bool http2 = false;
+    uint32_t max_streams = 100;
+    uint32_t workers = std::max(std::thread::hardware_concurrency(), 1u);
+    FaultProfile faults;
+    std::string reply_body{kH2cReplyBody};
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -36,11 +59,50 @@ int main(int argc, char* argv[]) {
                 return -1;
             }
             port = atoi(argv[i + 1]);
+        } else if ((arg == "-2") || (arg == "--http2")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid http2 option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            http2 = (atoi(argv[i + 1]) != 0);
+        } else if ((arg == "-s") || (arg == "--max-streams")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid max streams option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            max_streams = atoi(argv[i + 1]);
+        } else if ((arg == "-w") || (arg == "--workers")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                std::cout << "Invalid workers option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            workers = atoi(argv[i + 1]);
+        } else if ((arg == "-f") || (arg == "--fault-profile")) {
+            if (i + 1 >= argc || !faults.Load(argv[i + 1])) {
+                std::cout << "Invalid fault profile option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+        } else if ((arg == "-b") || (arg == "--reply-body")) {
+            if (i + 1 >= argc) {
+                std::cout << "Invalid reply body option" << std::endl;
+                ShowHelp();
+                return -1;
+            }
+            reply_body = std::string(argv[i + 1]);
         }
     }
 
     try {
-        HttpTestServer htpp_server(ip_addr, port);
+        if (http2) {
+            Http2TestServer h2c_server(ip_addr, port, max_streams,
+                                       reply_body);
+            return 0;
+        }
+        HttpTestServer htpp_server(ip_addr, port, workers, faults);
     } catch (std::runtime_error const& e) {
         std::cout << e.what() << std::endl;
     }
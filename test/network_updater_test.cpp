@@ -1,13 +1,46 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <random>
 #include <thread>
 #include <vector>
 
 #include <fstream>
+#include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 
+#include "../include/circuit_breaker.hpp"
+#include "../include/client_id_generator.hpp"
+#include "../include/concurrency_limiter.hpp"
+#include "../include/json.hpp"
+#include "../include/latency_histogram.hpp"
+#include "../include/mac_address.hpp"
+#include "../include/mac_list_reader.hpp"
+#include "../include/mac_set.hpp"
 #include "../include/network_updater.hpp"
+#include "../include/parsed_url.hpp"
+#include "../include/payload_buffer.hpp"
+#include "../include/rate_limiter.hpp"
+#include "../include/request_stats.hpp"
+#include "../include/request_template.hpp"
+#include "../include/retry_policy.hpp"
+#include "../include/retry_scheduler.hpp"
+#include "../include/token_bucket.hpp"
+#include "../include/token_cache.hpp"
+#include "../include/token_manager.hpp"
+#include "../include/update_dispatcher.hpp"
+#include "../test/allocation_counter.hpp"
+#include "../test/fault_profile.hpp"
+#include "../test/http2_test_server.hpp"
+#include "../test/http_request_parser.hpp"
 #include "../test/http_test_server.hpp"
 
 class NetworkUpdaterTest : public ::testing::Test {
@@ -15,9 +48,43 @@ class NetworkUpdaterTest : public ::testing::Test {
     static void SetUpTestSuite() {
         tcp_server = new std::thread(NetworkUpdaterTest::StartTCPServer);
         tcp_server->detach();
+        h2c_server = new std::thread(NetworkUpdaterTest::StartH2cServer);
+        h2c_server->detach();
+
+        // the first tests must not race the servers to their listen()
+        WaitForServer(8080);
+        WaitForServer(8081);
     }
 
-    static void TearDownTestSuite() { delete tcp_server; }
+    static void WaitForServer(int port) {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (int attempt = 0; attempt < 200; attempt++) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                        sizeof(addr)) == 0) {
+                // a request no test answers to, then wait for the close
+                constexpr char kProbe[] = "PROBE / HTTP/1.1\r\n\r\n";
+                char reply[256];
+                if (write(fd, kProbe, sizeof(kProbe) - 1) > 0 &&
+                    shutdown(fd, SHUT_WR) == 0) {
+                    while (read(fd, reply, sizeof(reply)) > 0) {
+                    }
+                }
+                close(fd);
+                return;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    static void TearDownTestSuite() {
+        delete tcp_server;
+        delete h2c_server;
+    }
 
     void SetUp() override {
         CreateHostFile();
@@ -37,6 +104,15 @@ class NetworkUpdaterTest : public ::testing::Test {
         }
     }
 
+    static void StartH2cServer() {
+        try {
+            Http2TestServer h2c_server("0.0.0.0", 8081, 10,
+                                       "../test/headers/200.txt");
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }
+
     void CreateHostFile() {
         std::ofstream hostf(host_file_.c_str());
         if (hostf.is_open()) {
@@ -75,10 +151,13 @@ class NetworkUpdaterTest : public ::testing::Test {
     std::string json_config_{"test_config.json"};
     std::string uri_{"http://localhost"};
     int port_{8080};
+    int h2c_port_{8081};
     static std::thread* tcp_server;
+    static std::thread* h2c_server;
 };
 
 std::thread* NetworkUpdaterTest::tcp_server = nullptr;
+std::thread* NetworkUpdaterTest::h2c_server = nullptr;
 
 TEST_F(NetworkUpdaterTest, ThrowWrongHostFile) {
     std::unique_ptr<NetworkUpdater> nwup;
@@ -135,7 +214,7 @@ TEST_F(NetworkUpdaterTest, CheckMacList) {
         nwup = std::make_unique<NetworkUpdater>(
             host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
 
-    std::vector<std::string> mac_list = nwup->GetMacList();
+    std::vector<std::string> mac_list = nwup->GetMacList().ToStrings();
 
     // 4 mac addresses in the host file
     EXPECT_EQ(mac_list.size(), 4);
@@ -222,3 +301,1493 @@ TEST_F(NetworkUpdaterTest, WrongPort) {
     EXPECT_EQ(status, NetworkUpdater::UpdaterErr::Fail);
     EXPECT_EQ(status_code, 0);
 }
+
+TEST_F(NetworkUpdaterTest, DispatchConcurrently) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 4, false);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+
+    // every host fails, the 401 and 500 ones once their retries are spent
+    uint32_t failed = 0;
+    uint32_t retried = 0;
+    std::string line;
+    while (std::getline(log, line)) {
+        if (line.find("Unable to send request") != std::string::npos) {
+            failed++;
+        } else if (line.find("Retrying") != std::string::npos) {
+            retried++;
+        }
+    }
+
+    RetryPolicy policy;
+    EXPECT_EQ(failed, 4);
+    EXPECT_EQ(retried, policy.unauthorized.max_retries +
+                           policy.server_error.max_retries);
+}
+
+TEST_F(NetworkUpdaterTest, DispatchFailFast) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 2, true);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Fail);
+}
+
+TEST_F(NetworkUpdaterTest, DispatchEventLoop) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 4, false,
+                                UpdateDispatcher::Mode::EventLoop);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+
+    uint32_t failed = 0;
+    uint32_t retried = 0;
+    std::string line;
+    while (std::getline(log, line)) {
+        if (line.find("Unable to send request") != std::string::npos) {
+            failed++;
+        } else if (line.find("Retrying") != std::string::npos) {
+            retried++;
+        }
+    }
+
+    RetryPolicy policy;
+    EXPECT_EQ(failed, 4);
+    EXPECT_EQ(retried, policy.unauthorized.max_retries +
+                           policy.server_error.max_retries);
+}
+
+TEST_F(NetworkUpdaterTest, RefreshTokenOffTheEventLoop) {
+    // a token endpoint that takes a second to answer
+    FaultProfile faults;
+    faults.latency = FaultProfile::Latency::Fixed;
+    faults.latency_min = std::chrono::milliseconds(1000);
+    faults.latency_max = faults.latency_min;
+    std::thread([faults]() {
+        try {
+            HttpTestServer token_server("0.0.0.0", 8086, 1, faults);
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }).detach();
+    WaitForServer(8086);
+
+    // the first host is refused, the others are not
+    constexpr uint64_t kHosts = 50;
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n"
+          << "\"b1:11:cc:dd:ee:ff, 1, 2, 3\"\n";
+    char mac[MacAddress::kTextLength + 1] = {};
+    for (uint64_t i = 0; i < kHosts; i++) {
+        MacAddress(0xaa0000000000ULL | i).Format(mac);
+        hostf << '"' << mac << ", 1, 2, 3\"\n";
+    }
+    hostf.close();
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    ASSERT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), json_config_.c_str(),
+                        uri_.c_str(), port_));
+    ASSERT_EQ(nwup->SetTokenEndpoint(uri_ + ":8086/token", ""),
+              NetworkUpdater::UpdaterErr::Ok);
+    ASSERT_EQ(nwup->RequestToken(), NetworkUpdater::UpdaterErr::Ok);
+    TokenManager& tokens = nwup->GetTokenManager();
+    ASSERT_EQ(tokens.GetRefreshCount(), 1);
+
+    RetryPolicy policy;
+    policy.unauthorized.max_retries = 1;
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 4, false,
+                                UpdateDispatcher::Mode::EventLoop);
+    dispatcher.SetRetryPolicy(policy);
+    std::thread run([&dispatcher] {
+        EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+    });
+
+    // the other hosts are done while the 401 one waits for its token
+    const RequestStats& stats = nwup->GetRequestStats();
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(5000);
+    const LatencyHistogram* done = nullptr;
+    while (std::chrono::steady_clock::now() < deadline &&
+           (done == nullptr || done->GetCount() < kHosts)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        done = stats.GetHistogram(200, RequestStats::Phase::Total);
+    }
+    EXPECT_EQ(tokens.GetRefreshCount(), 1);
+    run.join();
+
+    ASSERT_NE(done, nullptr);
+    EXPECT_EQ(done->GetCount(), kHosts);
+    // a token for the 401 and another one for its retry
+    EXPECT_EQ(tokens.GetRefreshCount(), 3);
+    EXPECT_NE(log.str().find("Retrying to send request for host mac: "
+                             "b1:11:cc:dd:ee:ff"),
+              std::string::npos);
+    EXPECT_NE(log.str().find("Unable to send request for the host with mac "
+                             "b1:11:cc:dd:ee:ff"),
+              std::string::npos);
+}
+
+TEST_F(NetworkUpdaterTest, ScheduleRetries) {
+    using std::chrono::milliseconds;
+    RetryScheduler retries;
+    auto now = RetryScheduler::Clock::now();
+    auto schedule = [&retries, now](uint64_t mac, int64_t delay_ms) {
+        retries.Schedule({MacAddress(mac), 0, 1},
+                         now + milliseconds(delay_ms));
+    };
+
+    // out of order, some of them more than a turn of the wheel away
+    schedule(3, 30);
+    schedule(1, 10);
+    schedule(4, 3000);
+    schedule(2, 20);
+    schedule(5, 3000 + RetryScheduler::kSlotCount);
+    EXPECT_EQ(retries.size(), 5);
+    EXPECT_GE(retries.GetNextDue(), now + milliseconds(10));
+    EXPECT_LE(retries.GetNextDue(), now + milliseconds(11));
+
+    RetryScheduler::Entry entry;
+    EXPECT_FALSE(retries.PopDue(now + milliseconds(5), &entry));
+    std::vector<uint64_t> popped;
+    while (retries.PopDue(now + milliseconds(100), &entry)) {
+        popped.push_back(entry.mac.value());
+    }
+    EXPECT_THAT(popped, testing::ElementsAre(1, 2, 3));
+
+    // the next one is found past the current turn
+    EXPECT_GE(retries.GetNextDue(), now + milliseconds(3000));
+    EXPECT_FALSE(retries.PopDue(now + milliseconds(2990), &entry));
+    ASSERT_TRUE(retries.PopDue(now + milliseconds(10000), &entry));
+    EXPECT_EQ(entry.mac.value(), 4);
+    ASSERT_TRUE(retries.PopDue(now + milliseconds(10000), &entry));
+    EXPECT_EQ(entry.mac.value(), 5);
+    EXPECT_TRUE(retries.empty());
+
+    // a retry already due goes first
+    schedule(6, 0);
+    EXPECT_LE(retries.GetNextDue(), RetryScheduler::Clock::now());
+    EXPECT_TRUE(retries.PopDue(RetryScheduler::Clock::now(), &entry));
+
+    RetryPolicy policy;
+    EXPECT_EQ(policy.GetRule(NetworkUpdater::UpdaterErr::Retry, 401),
+              &policy.unauthorized);
+    EXPECT_EQ(policy.GetRule(NetworkUpdater::UpdaterErr::Fail, 0),
+              &policy.transport_error);
+    EXPECT_EQ(policy.GetRule(NetworkUpdater::UpdaterErr::Fail, 429),
+              &policy.throttled);
+    EXPECT_EQ(policy.GetRule(NetworkUpdater::UpdaterErr::Fail, 503),
+              &policy.server_error);
+    EXPECT_EQ(policy.GetRule(NetworkUpdater::UpdaterErr::Fail, 404), nullptr);
+    EXPECT_EQ(policy.GetRule(NetworkUpdater::UpdaterErr::Fail, 401), nullptr);
+
+    // half of the doubled delay is kept, the rest is jitter, up to the cap
+    RetryPolicy::Rule rule{5, milliseconds(100), milliseconds(1000)};
+    std::mt19937_64 rng(42);
+    for (uint32_t retry = 0; retry < 6; retry++) {
+        int64_t delay = std::min<int64_t>(100 << retry, 1000);
+        for (int i = 0; i < 100; i++) {
+            milliseconds jittered = RetryPolicy::GetDelay(rule, retry, &rng);
+            EXPECT_GE(jittered.count(), delay / 2);
+            EXPECT_LE(jittered.count(), delay);
+        }
+    }
+
+    // a base too large to double 20 times is capped without overflowing
+    RetryPolicy::Rule slow{20, milliseconds(int64_t{1} << 50),
+                           milliseconds(int64_t{1} << 51)};
+    milliseconds capped = RetryPolicy::GetDelay(slow, 20, &rng);
+    EXPECT_GE(capped.count(), int64_t{1} << 50);
+    EXPECT_LE(capped.count(), int64_t{1} << 51);
+
+    std::string policy_file = "retry_policy_test.json";
+    std::ofstream(policy_file)
+        << R"({"server_error": {"max_retries": 1, "base_delay_ms": 5}})";
+    ASSERT_TRUE(policy.Load(policy_file.c_str()));
+    EXPECT_EQ(policy.server_error.max_retries, 1);
+    EXPECT_EQ(policy.server_error.base_delay, milliseconds(5));
+    EXPECT_EQ(policy.throttled.max_retries,
+              RetryPolicy().throttled.max_retries);
+
+    std::ofstream(policy_file) << R"({"throttled": {"max_retries": -1}})";
+    EXPECT_FALSE(policy.Load(policy_file.c_str()));
+    std::remove(policy_file.c_str());
+}
+
+TEST_F(NetworkUpdaterTest, DispatchWhileRetriesWait) {
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n"
+          << "\"b4:44:cc:dd:ee:ff, 1, 2, 3\"\n"
+          << "\"b2:22:cc:dd:ee:ff, 1, 2, 3\"\n"
+          << "\"b3:33:cc:dd:ee:ff, 1, 2, 3\"\n";
+    hostf.close();
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    RetryPolicy policy;
+    policy.server_error = {2, std::chrono::milliseconds(100),
+                           std::chrono::milliseconds(100)};
+    // a single request at a time, the 404 and 409 hosts are still done while
+    // the 500 one waits for its first retry
+    for (auto mode : {UpdateDispatcher::Mode::Threads,
+                      UpdateDispatcher::Mode::EventLoop}) {
+        std::stringstream log;
+        UpdateDispatcher dispatcher(nwup.get(), &log, 1, false, mode);
+        dispatcher.SetRetryPolicy(policy);
+        auto started_at = std::chrono::steady_clock::now();
+        EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+        EXPECT_GE(std::chrono::steady_clock::now() - started_at,
+                  std::chrono::milliseconds(100));
+
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(log, line)) {
+            // the first word and the mac
+            lines.push_back(line.substr(0, line.find(' ')) +
+                            line.substr(line.find(" b"), 18));
+        }
+        EXPECT_THAT(lines, testing::ElementsAre("Retrying b4:44:cc:dd:ee:ff",
+                                                "Unable b2:22:cc:dd:ee:ff",
+                                                "Unable b3:33:cc:dd:ee:ff",
+                                                "Retrying b4:44:cc:dd:ee:ff",
+                                                "Unable b4:44:cc:dd:ee:ff"));
+    }
+}
+
+TEST_F(NetworkUpdaterTest, AdaptConcurrencyLimit) {
+    ConcurrencyLimiter limiter(1, 64, 4);
+    // every round fills the limit and then gets all the replies back
+    auto run_round = [&limiter](std::chrono::microseconds latency,
+                                bool dropped) {
+        uint32_t sent = 0;
+        while (limiter.TryAcquire()) {
+            sent++;
+        }
+        for (uint32_t i = 0; i < sent; i++) {
+            limiter.Release(latency, dropped);
+        }
+    };
+
+    EXPECT_EQ(limiter.GetLimit(), 4);
+    for (int i = 0; i < 100; i++) {
+        run_round(std::chrono::microseconds(1000), false);
+    }
+    uint32_t grown = limiter.GetLimit();
+    EXPECT_GT(grown, 8);
+    EXPECT_LE(grown, 64);
+    EXPECT_EQ(limiter.GetInFlight(), 0);
+
+    // 5xx replies and timeouts cut the limit
+    for (int i = 0; i < 20; i++) {
+        run_round(std::chrono::microseconds(1000), true);
+    }
+    uint32_t backed_off = limiter.GetLimit();
+    EXPECT_LT(backed_off, grown);
+
+    // so does a p99 far above the one the server used to have
+    for (int i = 0; i < 20; i++) {
+        run_round(std::chrono::microseconds(10000), false);
+    }
+    EXPECT_LT(limiter.GetLimit(), backed_off);
+    EXPECT_GE(limiter.GetLimit(), 1);
+
+    EXPECT_TRUE(ConcurrencyLimiter::IsDropped(0));
+    EXPECT_TRUE(ConcurrencyLimiter::IsDropped(503));
+    EXPECT_FALSE(ConcurrencyLimiter::IsDropped(409));
+}
+
+TEST_F(NetworkUpdaterTest, DispatchAdaptiveConcurrency) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    // the limiter must not change which hosts fail or get retried
+    for (auto mode : {UpdateDispatcher::Mode::Threads,
+                      UpdateDispatcher::Mode::EventLoop}) {
+        std::stringstream log;
+        UpdateDispatcher dispatcher(nwup.get(), &log, 8, false, mode);
+        dispatcher.SetAdaptiveConcurrency(true);
+        ASSERT_NE(dispatcher.GetLimiter(), nullptr);
+        EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+        EXPECT_EQ(dispatcher.GetLimiter()->GetInFlight(), 0);
+
+        uint32_t failed = 0;
+        std::string line;
+        while (std::getline(log, line)) {
+            if (line.find("Unable to send request") != std::string::npos) {
+                failed++;
+            }
+        }
+        EXPECT_EQ(failed, 4);
+    }
+}
+
+TEST_F(NetworkUpdaterTest, PaceWithTokenBuckets) {
+    using std::chrono::milliseconds;
+    using std::chrono::microseconds;
+    auto now = TokenBucket::Clock::now();
+
+    // the burst goes at once, then one token per interval
+    TokenBucket bucket(1000, 10);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(bucket.Reserve(now), now);
+    }
+    EXPECT_EQ(bucket.Reserve(now), now + milliseconds(1));
+    EXPECT_EQ(bucket.Reserve(now), now + milliseconds(2));
+    // a caller late for its token does not shift the next ones
+    EXPECT_EQ(bucket.Reserve(now + milliseconds(5)), now + milliseconds(5));
+    EXPECT_EQ(bucket.Reserve(now), now + milliseconds(4));
+
+    // threads taking tokens together get every token exactly once
+    TokenBucket shared(1e6, 1);
+    std::vector<std::vector<TokenBucket::Clock::time_point>> taken(4);
+    std::vector<std::thread> threads;
+    for (auto& times : taken) {
+        threads.emplace_back([&shared, &times, now]() {
+            for (int i = 0; i < 10000; i++) {
+                times.push_back(shared.Reserve(now));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::set<TokenBucket::Clock::time_point> times;
+    for (const auto& thread_times : taken) {
+        times.insert(thread_times.begin(), thread_times.end());
+    }
+    EXPECT_EQ(times.size(), 40000);
+    EXPECT_EQ(*times.rbegin(), now + microseconds(39999));
+
+    // group 1 is throttled, group 2 is not, all of them share the global rate
+    RateLimiter limiter(1000, [](uint32_t group) {
+        return group == 1 ? 100.0 : 0.0;
+    });
+    EXPECT_EQ(limiter.ReserveGroup(1, now), now);
+    EXPECT_EQ(limiter.ReserveGroup(1, now), now + milliseconds(10));
+    EXPECT_EQ(limiter.ReserveGroup(2, now), now);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(limiter.ReserveGlobal(now), now);
+    }
+    EXPECT_EQ(limiter.ReserveGlobal(now), now + milliseconds(1));
+
+    // however many groups there are, each one has a bucket of its own
+    RateLimiter many_groups(0, [](uint32_t) { return 100.0; });
+    for (uint32_t group : {4095u, 4096u, 100000u, 1u << 20}) {
+        EXPECT_EQ(many_groups.ReserveGroup(group, now), now);
+        EXPECT_EQ(many_groups.ReserveGroup(group, now),
+                  now + milliseconds(10));
+    }
+
+    RateLimiter unlimited(0, RateLimiter::GroupRate());
+    EXPECT_EQ(unlimited.ReserveGroup(1, now), now);
+    EXPECT_EQ(unlimited.ReserveGlobal(now), now);
+}
+
+TEST_F(NetworkUpdaterTest, DispatchGroupedHosts) {
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n";
+    for (int i = 0; i < 10; i++) {
+        hostf << "\"bb:11:cc:dd:ee:0" << i << ", site-a, 2, 3\"\n"
+              << "\"bb:22:cc:dd:ee:0" << i << ", site-b, 2, 3\"\n";
+    }
+    hostf.close();
+
+    MacListReader reader;
+    ASSERT_TRUE(reader.Open(host_file_.c_str()));
+    std::string_view mac_addr;
+    ASSERT_TRUE(reader.Next(&mac_addr));
+    EXPECT_EQ(reader.GetColumn(0), "bb:11:cc:dd:ee:00");
+    EXPECT_EQ(reader.GetColumn(1), "site-a");
+    EXPECT_EQ(reader.GetColumn(3), "3");
+    EXPECT_EQ(reader.GetColumn(4), "");
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), json_config_.c_str(),
+                        uri_.c_str(), port_, false, 1));
+    ASSERT_EQ(nwup->GetGroupCount(), 2);
+    EXPECT_EQ(nwup->GetGroupName(0), "site-a");
+    EXPECT_EQ(nwup->GetGroupName(1), "site-b");
+    const MacList& mac_list = nwup->GetMacList();
+    ASSERT_EQ(mac_list.size(), 20);
+    EXPECT_EQ(mac_list.group(0), 0);
+    EXPECT_EQ(mac_list.group(1), 1);
+
+    // site-a is held to 50 requests/s, nine intervals after the first one
+    for (auto mode : {UpdateDispatcher::Mode::Threads,
+                      UpdateDispatcher::Mode::EventLoop}) {
+        std::stringstream log;
+        UpdateDispatcher dispatcher(nwup.get(), &log, 4, false, mode);
+        dispatcher.SetRateLimit(0, 0, {{"site-a", 50}});
+
+        auto started_at = std::chrono::steady_clock::now();
+        EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+        auto elapsed = std::chrono::steady_clock::now() - started_at;
+        EXPECT_GE(elapsed, std::chrono::milliseconds(170));
+        EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+        EXPECT_EQ(log.str().find("Unable to send request"), std::string::npos);
+    }
+}
+
+TEST_F(NetworkUpdaterTest, ReusePooledSessions) {
+    uint32_t status_code = 0;
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    EXPECT_EQ(nwup->SendRequest("bb:11:cc:dd:ee:ff", &status_code),
+              NetworkUpdater::UpdaterErr::Ok);
+    EXPECT_EQ(nwup->SendRequest("bb:22:cc:dd:ee:ff", &status_code),
+              NetworkUpdater::UpdaterErr::Ok);
+
+    ConnectionPool::Stats stats = nwup->GetConnectionPool().GetStats();
+    EXPECT_EQ(stats.sessions_created, 1);
+    EXPECT_EQ(stats.sessions_reused, 1);
+    // the test server keeps the connection alive
+    EXPECT_EQ(stats.connections_opened, 1);
+    EXPECT_EQ(stats.connections_reused, 1);
+}
+
+TEST_F(NetworkUpdaterTest, LatencyHistogramPercentiles) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.GetPercentile(50), 0);
+    for (uint64_t value = 1; value <= 100000; value++) {
+        histogram.Record(value);
+    }
+
+    EXPECT_EQ(histogram.GetCount(), 100000);
+    EXPECT_EQ(histogram.GetMax(), 100000);
+    EXPECT_DOUBLE_EQ(histogram.GetMean(), 50000.5);
+    // exact below 128, within 1% above
+    EXPECT_EQ(histogram.GetPercentile(0.1), 100);
+    EXPECT_NEAR(histogram.GetPercentile(50), 50000, 500);
+    EXPECT_NEAR(histogram.GetPercentile(99), 99000, 990);
+    EXPECT_NEAR(histogram.GetPercentile(99.9), 99900, 999);
+    EXPECT_EQ(histogram.GetPercentile(100), 100000);
+
+    // far beyond any request, counted as the largest value
+    histogram.Record(uint64_t{1} << 40);
+    EXPECT_EQ(histogram.GetPercentile(100), uint64_t{1} << 40);
+}
+
+TEST_F(NetworkUpdaterTest, RecordRequestTimings) {
+    uint32_t status_code = 0;
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    RequestStats& stats = nwup->GetRequestStats();
+    stats.Start();
+    nwup->SendRequest("bb:11:cc:dd:ee:ff", &status_code);
+    nwup->SendRequest("bb:22:cc:dd:ee:ff", &status_code);
+    nwup->SendRequest("b2:22:cc:dd:ee:ff", &status_code);
+    stats.Stop();
+
+    EXPECT_EQ(stats.GetCount(), 3);
+    EXPECT_GT(stats.GetRequestsPerSecond(), 0);
+    ASSERT_NE(stats.GetHistogram(200, RequestStats::Phase::Total), nullptr);
+    ASSERT_NE(stats.GetHistogram(404, RequestStats::Phase::Total), nullptr);
+    EXPECT_EQ(stats.GetHistogram(409, RequestStats::Phase::Total), nullptr);
+    const LatencyHistogram* total =
+        stats.GetHistogram(200, RequestStats::Phase::Total);
+    EXPECT_EQ(total->GetCount(), 2);
+    EXPECT_GT(total->GetMax(), 0);
+    EXPECT_LE(stats.GetHistogram(200, RequestStats::Phase::FirstByte)
+                  ->GetMax(),
+              total->GetMax());
+    // the second request reused the connection of the first one
+    EXPECT_EQ(stats.GetHistogram(200, RequestStats::Phase::Connect)
+                  ->GetPercentile(50),
+              0);
+
+    // the summary leaves the format of the stream as it found it
+    std::stringstream summary;
+    summary.precision(2);
+    stats.PrintSummary(&summary);
+    EXPECT_NE(summary.str().find("Status 404: 1 requests"), std::string::npos);
+    EXPECT_EQ(summary.precision(), 2);
+    EXPECT_EQ(summary.flags() & std::ios_base::floatfield, 0);
+
+    const char* report_file = "test_report.json";
+    ASSERT_TRUE(stats.WriteJson(report_file));
+    std::ifstream report_stream(report_file);
+    std::stringstream report_text;
+    report_text << report_stream.rdbuf();
+    auto report = nlohmann::json::parse(report_text.str());
+    EXPECT_EQ(report["requests"], 3);
+    EXPECT_EQ(report["status_codes"]["200"]["count"], 2);
+    EXPECT_EQ(report["status_codes"]["404"]["count"], 1);
+    EXPECT_TRUE(report["status_codes"]["404"]["total"].contains("p999"));
+    remove(report_file);
+}
+
+TEST_F(NetworkUpdaterTest, ServePipelinedRequests) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+              0);
+    timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // two requests with bodies in a single write, on one connection
+    std::string body = "{\"profile\": {}}";
+    std::string requests;
+    for (const char* mac : {"aa:11:cc:dd:ee:ff", "b2:22:cc:dd:ee:ff"}) {
+        requests += std::string("PUT /profiles/clientId:") + mac +
+                    " HTTP/1.1\r\nHost: localhost\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+    ASSERT_EQ(write(fd, requests.data(), requests.size()),
+              static_cast<ssize_t>(requests.size()));
+
+    std::string replies;
+    char buffer[4096];
+    while (replies.find("HTTP/1.1 404") == std::string::npos) {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes <= 0) {
+            break;
+        }
+        replies.append(buffer, bytes);
+    }
+    close(fd);
+
+    size_t ok = replies.find("HTTP/1.1 200");
+    size_t not_found = replies.find("HTTP/1.1 404");
+    ASSERT_NE(ok, std::string::npos);
+    ASSERT_NE(not_found, std::string::npos);
+    EXPECT_LT(ok, not_found);
+}
+
+TEST_F(NetworkUpdaterTest, AnswerExpectContinue) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+              0);
+    timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // the body only goes once the server asked for it
+    std::string body = "{\"profile\": {}}";
+    std::string headers =
+        "PUT /profiles/clientId:aa:11:cc:dd:ee:ff HTTP/1.1\r\n"
+        "Host: localhost\r\nExpect: 100-continue\r\nContent-Length: " +
+        std::to_string(body.size()) + "\r\n\r\n";
+    ASSERT_EQ(write(fd, headers.data(), headers.size()),
+              static_cast<ssize_t>(headers.size()));
+
+    std::string replies;
+    char buffer[4096];
+    auto read_until = [&](const char* expected) {
+        while (replies.find(expected) == std::string::npos) {
+            ssize_t bytes = read(fd, buffer, sizeof(buffer));
+            if (bytes <= 0) {
+                return false;
+            }
+            replies.append(buffer, bytes);
+        }
+        return true;
+    };
+    EXPECT_TRUE(read_until("HTTP/1.1 100 Continue\r\n\r\n"));
+    ASSERT_EQ(write(fd, body.data(), body.size()),
+              static_cast<ssize_t>(body.size()));
+    EXPECT_TRUE(read_until("HTTP/1.1 200"));
+    close(fd);
+}
+
+TEST_F(NetworkUpdaterTest, LoadFaultProfile) {
+    const char* profile_file = "test_fault_profile.json";
+    {
+        std::ofstream profile(profile_file);
+        profile << R"({"seed": 7,
+                       "latency": {"distribution": "long_tail", "min_ms": 2,
+                                   "max_ms": 50, "shape": 1.2},
+                       "error_rates": {"500": 0.25, "503": 0.25}})";
+    }
+    FaultProfile faults;
+    ASSERT_TRUE(faults.Load(profile_file));
+    EXPECT_TRUE(faults.IsActive());
+    EXPECT_EQ(faults.latency, FaultProfile::Latency::LongTail);
+    EXPECT_EQ(faults.latency_min, std::chrono::milliseconds(2));
+    EXPECT_EQ(faults.latency_max, std::chrono::milliseconds(50));
+
+    // the same seed replays the same faults
+    std::mt19937_64 rng(faults.seed);
+    std::mt19937_64 replay(faults.seed);
+    std::set<int> codes;
+    for (int i = 0; i < 1000; i++) {
+        auto latency = faults.SampleLatency(&rng);
+        EXPECT_GE(latency, faults.latency_min);
+        EXPECT_LE(latency, faults.latency_max);
+        EXPECT_EQ(latency, faults.SampleLatency(&replay));
+        int code = faults.SampleErrorCode(&rng);
+        EXPECT_EQ(code, faults.SampleErrorCode(&replay));
+        codes.insert(code);
+    }
+    EXPECT_EQ(codes, std::set<int>({0, 500, 503}));
+
+    {
+        std::ofstream profile(profile_file);
+        profile << R"({"error_rates": {"500": 0.75, "503": 0.5}})";
+    }
+    EXPECT_FALSE(FaultProfile().Load(profile_file));
+
+    {
+        std::ofstream profile(profile_file);
+        profile << R"({"slow_read": {"rate": 0.5, "bytes": -1}})";
+    }
+    EXPECT_FALSE(FaultProfile().Load(profile_file));
+    remove(profile_file);
+}
+
+TEST_F(NetworkUpdaterTest, InjectServerFaults) {
+    // every reply 20ms late, half of them 500, every request read in pieces
+    FaultProfile faults;
+    faults.seed = 1;
+    faults.latency = FaultProfile::Latency::Fixed;
+    faults.latency_min = std::chrono::milliseconds(20);
+    faults.latency_max = faults.latency_min;
+    faults.error_rates[500] = 0.5;
+    faults.slow_read_rate = 1;
+    faults.slow_read_bytes = 64;
+    faults.slow_read_interval = std::chrono::milliseconds(1);
+    std::thread([faults]() {
+        try {
+            HttpTestServer faulty_server("0.0.0.0", 8082, 1, faults);
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }).detach();
+    WaitForServer(8082);
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    ASSERT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), json_config_.c_str(),
+                        uri_.c_str(), 8082));
+
+    constexpr int kRequests = 10;
+    std::map<uint32_t, int> replies;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRequests; i++) {
+        uint32_t status_code = 0;
+        nwup->SendRequest("aa:11:cc:dd:ee:ff", &status_code);
+        replies[status_code]++;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_GE(elapsed, kRequests * faults.latency_min);
+    EXPECT_GT(replies[200], 0);
+    EXPECT_GT(replies[500], 0);
+    EXPECT_EQ(replies[200] + replies[500], kRequests);
+}
+
+TEST_F(NetworkUpdaterTest, TimeoutHungServer) {
+    // the server reads every request and never answers
+    FaultProfile faults;
+    faults.stall_rate = 1;
+    std::thread([faults]() {
+        try {
+            HttpTestServer hung_server("0.0.0.0", 8083, 1, faults);
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }).detach();
+    WaitForServer(8083);
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    ASSERT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), json_config_.c_str(),
+                        uri_.c_str(), 8083));
+    nwup->SetTimeouts(std::chrono::milliseconds(1000),
+                      std::chrono::milliseconds(100));
+
+    uint32_t status_code = 200;
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(nwup->SendRequest("aa:11:cc:dd:ee:ff", &status_code),
+              NetworkUpdater::UpdaterErr::Fail);
+    EXPECT_EQ(status_code, 0);
+
+    // the event loop gives up on every host just as fast
+    RetryPolicy policy;
+    policy.transport_error.max_retries = 0;
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 4, false,
+                                UpdateDispatcher::Mode::EventLoop);
+    dispatcher.SetRetryPolicy(policy);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(1000));
+}
+
+TEST_F(NetworkUpdaterTest, HedgeStalledRequests) {
+    // 1 request in 20 hangs, the others are answered within a few ms
+    FaultProfile faults;
+    faults.seed = 7;
+    faults.stall_rate = 0.05;
+    faults.latency = FaultProfile::Latency::Uniform;
+    faults.latency_min = std::chrono::milliseconds(1);
+    faults.latency_max = std::chrono::milliseconds(3);
+    std::thread([faults]() {
+        try {
+            HttpTestServer stalling_server("0.0.0.0", 8084, 1, faults);
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }).detach();
+    WaitForServer(8084);
+
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n";
+    char mac[MacAddress::kTextLength + 1] = {};
+    for (uint64_t i = 0; i < 300; i++) {
+        MacAddress(0xaa0000000000ULL | i).Format(mac);
+        hostf << '"' << mac << ", 1, 2, 3\"\n";
+    }
+    hostf.close();
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    ASSERT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), json_config_.c_str(),
+                        uri_.c_str(), 8084));
+    nwup->SetTimeouts(std::chrono::milliseconds(1000),
+                      std::chrono::milliseconds(2000));
+
+    // a hedge that hangs too is left to the timeout and a retry
+    RetryPolicy policy;
+    policy.transport_error = {2, std::chrono::milliseconds(0),
+                              std::chrono::milliseconds(0)};
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 8, false,
+                                UpdateDispatcher::Mode::EventLoop);
+    dispatcher.SetRetryPolicy(policy);
+    dispatcher.SetHedging(true);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+    EXPECT_EQ(log.str().find("Unable to send request"), std::string::npos);
+
+    const RequestStats& stats = nwup->GetRequestStats();
+    EXPECT_GT(stats.GetHedgeCount(), 0);
+    EXPECT_GT(stats.GetHedgeWinCount(), 0);
+    EXPECT_LE(stats.GetHedgeWinCount(), stats.GetHedgeCount());
+}
+
+TEST_F(NetworkUpdaterTest, TripCircuitBreaker) {
+    CircuitBreaker breaker;
+    breaker.Configure(0.5, std::chrono::milliseconds(50));
+    bool probe = false;
+
+    // a few failures are not enough, half of the window is
+    for (size_t i = 0; i < CircuitBreaker::kMinRequests - 1; i++) {
+        ASSERT_TRUE(breaker.Allow(&probe));
+        EXPECT_FALSE(probe);
+        breaker.Record(true, probe);
+    }
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::Closed);
+    breaker.Record(true, false);
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::Open);
+    EXPECT_EQ(breaker.GetTripCount(), 1);
+
+    // open, the requests fail without being sent
+    EXPECT_FALSE(breaker.Allow(&probe));
+    EXPECT_FALSE(breaker.Allow(&probe));
+    EXPECT_EQ(breaker.GetRejectedCount(), 2);
+
+    // then a single probe goes, its failure opens it for longer
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_TRUE(breaker.Allow(&probe));
+    EXPECT_TRUE(probe);
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::HalfOpen);
+    bool second = false;
+    EXPECT_FALSE(breaker.Allow(&second));
+    EXPECT_FALSE(second);
+    breaker.Record(true, probe);
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::Open);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_FALSE(breaker.Allow(&probe));
+
+    // a request sent before the trip says nothing, the probe does
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_TRUE(breaker.Allow(&probe));
+    breaker.Record(false, false);
+    breaker.Record(true, false);
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::HalfOpen);
+    breaker.Record(false, probe);
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::Closed);
+    EXPECT_EQ(breaker.GetTripCount(), 2);
+
+    // successes keep the ratio under the threshold
+    for (int i = 0; i < 100; i++) {
+        breaker.Record(i % 3 == 0, false);
+    }
+    EXPECT_EQ(breaker.GetState(), CircuitBreaker::State::Closed);
+
+    EXPECT_TRUE(CircuitBreaker::IsFailure(0));
+    EXPECT_TRUE(CircuitBreaker::IsFailure(502));
+    EXPECT_FALSE(CircuitBreaker::IsFailure(404));
+
+    // disabled, nothing trips it
+    breaker.Configure(0, std::chrono::milliseconds(50));
+    for (int i = 0; i < 100; i++) {
+        breaker.Record(true, false);
+    }
+    EXPECT_TRUE(breaker.Allow(&probe));
+}
+
+TEST_F(NetworkUpdaterTest, DispatchToFailingServer) {
+    FaultProfile faults;
+    faults.stall_rate = 1;
+    std::thread([faults]() {
+        try {
+            HttpTestServer hung_server("0.0.0.0", 8085, 1, faults);
+        } catch (std::runtime_error const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }).detach();
+    WaitForServer(8085);
+
+    constexpr uint64_t kHosts = 200;
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n";
+    char mac[MacAddress::kTextLength + 1] = {};
+    for (uint64_t i = 0; i < kHosts; i++) {
+        MacAddress(0xaa0000000000ULL | i).Format(mac);
+        hostf << '"' << mac << ", 1, 2, 3\"\n";
+    }
+    hostf.close();
+
+    // every request would wait for its timeout, and its retries for theirs
+    for (auto mode : {UpdateDispatcher::Mode::Threads,
+                      UpdateDispatcher::Mode::EventLoop}) {
+        std::unique_ptr<NetworkUpdater> nwup;
+        ASSERT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                            host_file_.c_str(), json_config_.c_str(),
+                            uri_.c_str(), 8085));
+        nwup->SetTimeouts(std::chrono::milliseconds(1000),
+                          std::chrono::milliseconds(200));
+        nwup->GetCircuitBreaker().Configure(
+            CircuitBreaker::kDefaultFailureRatio,
+            std::chrono::milliseconds(100));
+
+        std::stringstream log;
+        UpdateDispatcher dispatcher(nwup.get(), &log, 4, false, mode);
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+        EXPECT_LT(std::chrono::steady_clock::now() - start,
+                  std::chrono::milliseconds(10000));
+
+        uint32_t failed = 0;
+        std::string line;
+        while (std::getline(log, line)) {
+            if (line.find("Unable to send request") != std::string::npos) {
+                failed++;
+            }
+        }
+        EXPECT_EQ(failed, kHosts);
+        EXPECT_GE(nwup->GetCircuitBreaker().GetTripCount(), 1);
+        EXPECT_GT(nwup->GetCircuitBreaker().GetRejectedCount(), kHosts);
+    }
+}
+
+TEST_F(NetworkUpdaterTest, SendRequestHttp2) {
+    uint32_t status_code = 0;
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), h2c_port_));
+    if (nwup->SetHttp2(true, 10) == NetworkUpdater::UpdaterErr::Fail) {
+        GTEST_SKIP() << "libcurl cannot multiplex HTTP/2 streams";
+    }
+
+    NetworkUpdater::UpdaterErr status =
+        nwup->SendRequest("bb:11:cc:dd:ee:ff", &status_code);
+    EXPECT_EQ(status, NetworkUpdater::UpdaterErr::Ok);
+    EXPECT_EQ(status_code, 200);
+}
+
+TEST_F(NetworkUpdaterTest, DispatchHttp2Multiplexed) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), h2c_port_));
+    if (nwup->SetHttp2(true, 10) == NetworkUpdater::UpdaterErr::Fail) {
+        GTEST_SKIP() << "libcurl cannot multiplex HTTP/2 streams";
+    }
+
+    // the h2c stand-in accepts every profile
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 4, true,
+                                UpdateDispatcher::Mode::EventLoop);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+
+    // all four streams shared a single connection
+    ConnectionPool::Stats stats = nwup->GetConnectionPool().GetStats();
+    EXPECT_EQ(stats.connections_opened, 1);
+    EXPECT_EQ(stats.connections_reused, 3);
+}
+
+TEST_F(NetworkUpdaterTest, RequestTemplateWithoutAllocations) {
+    RequestTemplate request("http://localhost:8080/profiles/clientId:");
+    std::string url;
+    std::string client_id_header;
+    request.InitUrl(&url);
+    request.InitClientIdHeader(&client_id_header);
+
+    std::vector<std::string> mac_list = {"b1:11:cc:dd:ee:ff",
+                                         "b2:22:cc:dd:ee:ff"};
+
+    AllocationCounter::Start();
+    for (uint32_t i = 0; i < 1000; i++) {
+        request.PatchUrl(mac_list[i % 2], &url);
+        request.PatchClientIdHeader(i * 4099, &client_id_header);
+    }
+    AllocationCounter::Stop();
+
+    EXPECT_EQ(AllocationCounter::GetCount(), 0);
+    EXPECT_EQ(url, "http://localhost:8080/profiles/clientId:b2:22:cc:dd:ee:ff");
+    EXPECT_EQ(client_id_header, "x-client-id: 4094901");
+}
+
+TEST_F(NetworkUpdaterTest, SendRequestWithoutAllocations) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+    MacAddress mac;
+    ASSERT_TRUE(MacAddress::Parse("bb:11:cc:dd:ee:ff", &mac));
+
+    // the first update sizes the buffers, opens the pooled session and
+    // creates the histograms of its status code
+    NetworkUpdater::RequestBuffers buffers;
+    uint32_t status_code = 0;
+    ASSERT_EQ(nwup->SendRequest(mac, &buffers, &status_code),
+              NetworkUpdater::UpdaterErr::Ok);
+
+    AllocationCounter::Start();
+    for (int i = 0; i < 100; i++) {
+        nwup->SendRequest(mac, &buffers, &status_code);
+    }
+    AllocationCounter::Stop();
+
+    EXPECT_EQ(AllocationCounter::GetCount(), 0);
+    EXPECT_EQ(status_code, 200);
+}
+
+TEST_F(NetworkUpdaterTest, PayloadSharedByReference) {
+    const char* config_file = "test_large_config.json";
+    std::string config =
+        "{\"profile\": {\"pad\": \"" + std::string(256 * 1024, 'x') + "\"}}";
+    {
+        std::ofstream config_stream(config_file);
+        config_stream << config;
+    }
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), config_file, uri_.c_str(), port_));
+    EXPECT_EQ(nwup->GetPayload().view(), config);
+
+    // the fresh session of the first request and the pooled one of the
+    // second hand the mapped bytes to curl, nothing the size of the payload
+    // is allocated
+    AllocationCounter::Start();
+    uint32_t status_code = 0;
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(nwup->SendRequest("bb:11:cc:dd:ee:ff", &status_code),
+                  NetworkUpdater::UpdaterErr::Ok);
+    }
+    AllocationCounter::Stop();
+    EXPECT_LT(AllocationCounter::GetLargest(), config.size());
+    remove(config_file);
+}
+
+TEST_F(NetworkUpdaterTest, LoadPayloadFromPipe) {
+    const char* fifo_name = "test_payload.fifo";
+    remove(fifo_name);
+    ASSERT_EQ(mkfifo(fifo_name, 0600), 0);
+
+    // a pipe has no size, its bytes are read rather than mapped
+    std::string config = "{\"profile\": {\"name\": \"piped\"}}";
+    std::thread writer([&]() {
+        std::ofstream fifo(fifo_name);
+        fifo << config;
+    });
+    PayloadBuffer payload;
+    EXPECT_TRUE(payload.Load(fifo_name));
+    writer.join();
+    EXPECT_EQ(payload.view(), config);
+
+    // a regular file is mapped again, the copy is dropped
+    ASSERT_TRUE(payload.Load(json_config_.c_str()));
+    EXPECT_NE(payload.size(), 0);
+    remove(fifo_name);
+}
+
+TEST_F(NetworkUpdaterTest, ReadMacListInPlace) {
+    MacListReader reader;
+    ASSERT_TRUE(reader.Open(host_file_.c_str()));
+
+    std::vector<std::string> mac_list;
+    std::string_view mac_addr;
+    while (reader.Next(&mac_addr)) {
+        mac_list.emplace_back(mac_addr);
+    }
+
+    ASSERT_THAT(mac_list,
+                testing::ElementsAre("b1:11:cc:dd:ee:ff", "b2:22:cc:dd:ee:ff",
+                                     "b3:33:cc:dd:ee:ff", "b4:44:cc:dd:ee:ff"));
+    EXPECT_EQ(reader.GetLineNumber(), 5);
+}
+
+TEST_F(NetworkUpdaterTest, DispatchStreamedHosts) {
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(nwup = std::make_unique<NetworkUpdater>(
+                        host_file_.c_str(), json_config_.c_str(),
+                        uri_.c_str(), port_, true));
+
+    // nothing is loaded up front
+    EXPECT_EQ(nwup->GetMacList().size(), 0);
+    ASSERT_NE(nwup->GetMacReader(), nullptr);
+
+    std::stringstream log;
+    UpdateDispatcher dispatcher(nwup.get(), &log, 2, false,
+                                UpdateDispatcher::Mode::EventLoop);
+    EXPECT_EQ(dispatcher.Run(), NetworkUpdater::UpdaterErr::Ok);
+
+    uint32_t failed = 0;
+    std::string line;
+    while (std::getline(log, line)) {
+        if (line.find("Unable to send request") != std::string::npos) {
+            failed++;
+        }
+    }
+
+    EXPECT_EQ(failed, 4);
+}
+
+TEST_F(NetworkUpdaterTest, PackedMacAddress) {
+    MacAddress mac;
+    ASSERT_TRUE(MacAddress::Parse("B1:11:cc:DD:ee:0f", &mac));
+    EXPECT_EQ(mac.value(), 0xb111ccddee0fULL);
+    EXPECT_EQ(mac.ToString(), "b1:11:cc:dd:ee:0f");
+    EXPECT_EQ(sizeof(MacAddress), sizeof(uint64_t));
+
+    EXPECT_FALSE(MacAddress::Parse("b1:11:cc:dd:ee", &mac));
+    EXPECT_FALSE(MacAddress::Parse("b1:11:cc:dd:ee:fg", &mac));
+    EXPECT_FALSE(MacAddress::Parse("b1.11.cc.dd.ee.ff", &mac));
+}
+
+TEST_F(NetworkUpdaterTest, NormalizeMacAddress) {
+    std::vector<std::string> valid = {"b1:11:cc:dd:ee:ff", "B1-11-CC-DD-EE-FF",
+                                      "b1:11:Cc:dD:ee:fF", "00:00:00:00:00:00",
+                                      "FF-ff-FF-ff-FF-ff"};
+    for (const auto& text : valid) {
+        MacAddress mac;
+        MacAddress scalar_mac;
+        ASSERT_TRUE(MacAddress::Parse(text, &mac)) << text;
+        ASSERT_TRUE(MacAddress::ParseScalar(text, &scalar_mac)) << text;
+        EXPECT_EQ(mac, scalar_mac) << text;
+    }
+
+    std::vector<std::string> invalid = {
+        "b1:11-cc:dd:ee:ff", "b1:11:cc:dd:ee:f",  "b1:11:cc:dd:ee:ffa",
+        "g1:11:cc:dd:ee:ff", "b1:11:cc:dd:ee:fG", "b1 11 cc dd ee ff",
+        "b1::1:cc:dd:ee:ff", "\xb1:11:cc:dd:ee:ff"};
+    for (const auto& text : invalid) {
+        MacAddress mac;
+        EXPECT_FALSE(MacAddress::Parse(text, &mac)) << text;
+        EXPECT_FALSE(MacAddress::ParseScalar(text, &mac)) << text;
+    }
+}
+
+TEST_F(NetworkUpdaterTest, RejectInvalidHosts) {
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n"
+          << "\"B1-11-CC-DD-EE-FF, 1, 2, 3\"\n"
+          << "\"zz:11:cc:dd:ee:ff, 1, 2, 3\"\n"
+          << "\"b2:22:cc:dd:ee:ff, 1, 2, 3\"\n";
+    hostf.close();
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    std::vector<std::string> mac_list = nwup->GetMacList().ToStrings();
+    ASSERT_THAT(mac_list, testing::ElementsAre("b1:11:cc:dd:ee:ff",
+                                               "b2:22:cc:dd:ee:ff"));
+
+    std::vector<NetworkUpdater::RejectedHost> rejected =
+        nwup->GetRejectedHosts();
+    ASSERT_EQ(rejected.size(), 1);
+    EXPECT_EQ(rejected[0].line_number, 3);
+    EXPECT_EQ(rejected[0].text, "zz:11:cc:dd:ee:ff");
+}
+
+TEST_F(NetworkUpdaterTest, RejectRowsMentioningMac) {
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n"
+          << "\"b1:11:cc:dd:ee:ff, mac-lab, 2, 3\"\n"
+          << "\"mac_addresses, id1, id2, id3\"\n"
+          << "\"b2:22:cc:dd:ee:ff, 1, 2, 3\"\n";
+    hostf.close();
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    // a row naming "mac" is a host unless it is the header on line 1
+    std::vector<std::string> mac_list = nwup->GetMacList().ToStrings();
+    ASSERT_THAT(mac_list, testing::ElementsAre("b1:11:cc:dd:ee:ff",
+                                               "b2:22:cc:dd:ee:ff"));
+
+    std::vector<NetworkUpdater::RejectedHost> rejected =
+        nwup->GetRejectedHosts();
+    ASSERT_EQ(rejected.size(), 1);
+    EXPECT_EQ(rejected[0].line_number, 3);
+    EXPECT_EQ(rejected[0].text, "mac_addresses");
+}
+
+TEST_F(NetworkUpdaterTest, RemoveDuplicateHosts) {
+    std::ofstream hostf(host_file_.c_str());
+    hostf << "\"mac_addresses, id1, id2, id3\"\n"
+          << "\"b1:11:cc:dd:ee:ff, 1, 2, 3\"\n"
+          << "\"00:00:00:00:00:00, 1, 2, 3\"\n"
+          << "\"B1-11-CC-DD-EE-FF, 1, 2, 3\"\n"
+          << "\"b2:22:cc:dd:ee:ff, 1, 2, 3\"\n"
+          << "\"00:00:00:00:00:00, 1, 2, 3\"\n";
+    hostf.close();
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+
+    // the first occurrence of each host is kept, in file order
+    std::vector<std::string> mac_list = nwup->GetMacList().ToStrings();
+    ASSERT_THAT(mac_list,
+                testing::ElementsAre("b1:11:cc:dd:ee:ff", "00:00:00:00:00:00",
+                                     "b2:22:cc:dd:ee:ff"));
+    EXPECT_EQ(nwup->GetDuplicateCount(), 2);
+
+    MacSet set;
+    for (uint64_t value = 0; value < 100000; value++) {
+        ASSERT_TRUE(set.insert(MacAddress(value * 0x1000001ULL)));
+    }
+    EXPECT_EQ(set.size(), 100000);
+    EXPECT_TRUE(set.contains(MacAddress(0)));
+    EXPECT_FALSE(set.insert(MacAddress(99999 * 0x1000001ULL)));
+    EXPECT_FALSE(set.contains(MacAddress(1)));
+}
+
+TEST_F(NetworkUpdaterTest, GenerateClientIds) {
+    ClientIdGenerator random_ids(NetworkUpdater::kMaxClientId);
+    for (int i = 0; i < 10000; i++) {
+        uint32_t id = random_ids.Next();
+        ASSERT_GE(id, 1);
+        ASSERT_LE(id, NetworkUpdater::kMaxClientId);
+    }
+
+    // every thread draws from the shared counter, no id is seen twice
+    ClientIdGenerator unique_ids(NetworkUpdater::kMaxClientId);
+    unique_ids.SetUnique(true);
+    constexpr int kThreads = 4;
+    constexpr int kIdsPerThread = 20000;
+    std::vector<std::vector<uint32_t>> ids(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&ids, &unique_ids, t] {
+            for (int i = 0; i < kIdsPerThread; i++) {
+                ids[t].push_back(unique_ids.Next());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::set<uint32_t> seen;
+    for (const auto& thread_ids : ids) {
+        seen.insert(thread_ids.begin(), thread_ids.end());
+    }
+    EXPECT_EQ(seen.size(), kThreads * kIdsPerThread);
+}
+
+TEST_F(NetworkUpdaterTest, ParseUrl) {
+    ParsedUrl url;
+    ASSERT_TRUE(ParsedUrl::Parse("https://fleet.example-1.com:8443/api", &url));
+    EXPECT_EQ(url.scheme, "https");
+    EXPECT_EQ(url.host, "fleet.example-1.com");
+    EXPECT_EQ(url.port, 8443);
+    EXPECT_EQ(url.path, "/api");
+    EXPECT_TRUE(url.IsHttps());
+    EXPECT_EQ(url.Join(8080), "https://fleet.example-1.com:8443/api");
+
+    ASSERT_TRUE(ParsedUrl::Parse("http://localhost", &url));
+    EXPECT_EQ(url.port, 0);
+    EXPECT_TRUE(url.path.empty());
+    EXPECT_EQ(url.Join(8080), "http://localhost:8080");
+    EXPECT_EQ(url.Join(0), "http://localhost");
+
+    std::vector<std::string> invalid = {
+        "localhost",           "ftp://localhost",      "http://",
+        "http://Localhost",    "http://localhost:",    "http://localhost:0",
+        "http://localhost:08", "http://localhost:65536",
+        "http://localhost:123456", "http://localhost/a b",
+        "http://localhost?x=1"};
+    for (const auto& text : invalid) {
+        EXPECT_FALSE(ParsedUrl::Parse(text, &url)) << text;
+    }
+
+    EXPECT_THROW(
+        NetworkUpdater(host_file_.c_str(), json_config_.c_str(),
+                       "http://local host", port_),
+        std::invalid_argument);
+}
+
+TEST_F(NetworkUpdaterTest, RefreshTokenOnce) {
+    std::atomic<int> fetches{0};
+    // a token that does not expire, expires_in is left at 0
+    TokenManager tokens([&fetches](std::string* token,
+                                   std::chrono::seconds* /* expires_in */) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        *token = "token" + std::to_string(++fetches);
+        return true;
+    });
+    ASSERT_TRUE(tokens.Refresh(0));
+    const TokenManager::Token& first = tokens.Current();
+    EXPECT_EQ(first.value, "token1");
+
+    // every request refused with the same token asks for a refresh
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; i++) {
+        threads.emplace_back([&tokens, &first] {
+            EXPECT_TRUE(tokens.Refresh(first.generation));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(fetches, 2);
+    EXPECT_EQ(tokens.Current().value, "token2");
+    EXPECT_EQ(tokens.Current().generation, first.generation + 1);
+    // the replaced token is still readable
+    EXPECT_EQ(first.value, "token1");
+}
+
+TEST_F(NetworkUpdaterTest, RefreshTokenOnceWhenFetchFails) {
+    std::atomic<int> fetches{0};
+    // the token endpoint is down and slow to say so
+    TokenManager tokens([&fetches](std::string* /* token */,
+                                   std::chrono::seconds* /* expires_in */) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        fetches++;
+        return false;
+    });
+
+    // the requests parked behind the failed fetch do not ask again
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; i++) {
+        threads.emplace_back([&tokens] { EXPECT_FALSE(tokens.Refresh(0)); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(fetches, 1);
+    EXPECT_EQ(tokens.GetRefreshCount(), 0);
+}
+
+TEST_F(NetworkUpdaterTest, RefreshTokenBeforeExpiry) {
+    std::atomic<int> fetches{0};
+    TokenManager tokens(
+        [&fetches](std::string* token, std::chrono::seconds* expires_in) {
+            *token = "token" + std::to_string(++fetches);
+            *expires_in = std::chrono::seconds(5);
+            return true;
+        },
+        std::chrono::seconds(2));
+    ASSERT_TRUE(tokens.Refresh(0));
+    EXPECT_EQ(tokens.Current().value, "token1");
+    EXPECT_EQ(fetches, 1);
+
+    // inside the refresh margin the next reader replaces the token
+    std::this_thread::sleep_for(std::chrono::milliseconds(3100));
+    EXPECT_EQ(tokens.Current().value, "token2");
+    EXPECT_EQ(tokens.GetRefreshCount(), 2);
+}
+
+TEST_F(NetworkUpdaterTest, RefreshShortLivedToken) {
+    std::atomic<int> fetches{0};
+    // lives for less than the default refresh margin
+    TokenManager tokens(
+        [&fetches](std::string* token, std::chrono::seconds* expires_in) {
+            *token = "token" + std::to_string(++fetches);
+            *expires_in = std::chrono::seconds(2);
+            return true;
+        });
+    ASSERT_TRUE(tokens.Refresh(0));
+    EXPECT_EQ(tokens.Current().value, "token1");
+    EXPECT_EQ(fetches, 1);
+
+    // replaced half way through its lifetime, not over and over
+    tokens.StartBackgroundRefresh();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    EXPECT_EQ(fetches, 2);
+    EXPECT_EQ(tokens.Current().value, "token2");
+}
+
+TEST_F(NetworkUpdaterTest, TokenEndpointWithCache) {
+    std::string token_url = uri_ + ":" + std::to_string(port_) + "/token";
+    std::string cache_file = "token_cache.json";
+    remove(cache_file.c_str());
+
+    std::unique_ptr<NetworkUpdater> nwup;
+    EXPECT_NO_THROW(
+        nwup = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+    ASSERT_EQ(nwup->SetTokenEndpoint(token_url, cache_file),
+              NetworkUpdater::UpdaterErr::Ok);
+    ASSERT_EQ(nwup->RequestToken(), NetworkUpdater::UpdaterErr::Ok);
+    std::string token = nwup->GetToken();
+    EXPECT_EQ(token.rfind("test-token-", 0), 0);
+    // one hour left, nothing to refresh yet
+    EXPECT_EQ(nwup->GetTokenManager().GetRefreshCount(), 1);
+    // only its owner can read the token, whatever the umask
+    struct stat cache_stat;
+    ASSERT_EQ(stat(cache_file.c_str(), &cache_stat), 0);
+    EXPECT_EQ(cache_stat.st_mode & 0777, 0600);
+
+    uint32_t status_code = 0;
+    EXPECT_EQ(nwup->SendRequest(std::string("a1:11:cc:dd:ee:ff"),
+                                &status_code),
+              NetworkUpdater::UpdaterErr::Ok);
+    EXPECT_EQ(status_code, 200);
+
+    // the next run starts from the cached token instead of asking again
+    std::unique_ptr<NetworkUpdater> next_run;
+    EXPECT_NO_THROW(
+        next_run = std::make_unique<NetworkUpdater>(
+            host_file_.c_str(), json_config_.c_str(), uri_.c_str(), port_));
+    ASSERT_EQ(next_run->SetTokenEndpoint(token_url, cache_file),
+              NetworkUpdater::UpdaterErr::Ok);
+    ASSERT_EQ(next_run->RequestToken(), NetworkUpdater::UpdaterErr::Ok);
+    EXPECT_EQ(next_run->GetToken(), token);
+
+    // a rejected token is replaced by a fresh one from the endpoint
+    EXPECT_EQ(next_run->SendRequest(std::string("b1:11:cc:dd:ee:ff"),
+                                    &status_code),
+              NetworkUpdater::UpdaterErr::Retry);
+    EXPECT_NE(next_run->GetToken(), token);
+    EXPECT_EQ(next_run->GetToken().rfind("test-token-", 0), 0);
+
+    EXPECT_EQ(nwup->SetTokenEndpoint("localhost/token", cache_file),
+              NetworkUpdater::UpdaterErr::Fail);
+
+    // a mangled cache is ignored rather than thrown at the refresher
+    {
+        std::ofstream cache(cache_file);
+        cache << R"({"token_url": 5, "token": "x", "expires_at": 0})";
+    }
+    std::string cached_token;
+    std::chrono::seconds expires_in{0};
+    EXPECT_FALSE(TokenCache(cache_file).Load(token_url, std::chrono::seconds(0),
+                                             &cached_token, &expires_in));
+    remove(cache_file.c_str());
+}
+
+TEST_F(NetworkUpdaterTest, ParseHttpRequestIncrementally) {
+    std::string body(1024 * 1024, 'x');
+    std::string stream =
+        "PUT /profiles/clientId:aa:11:cc:dd:ee:ff HTTP/1.1\r\n"
+        "Host: localhost\r\ncontent-length: " +
+        std::to_string(body.size()) + "\r\nX-Client-Id:  7 \r\n\r\n" + body +
+        "GET /second HTTP/1.0\r\n\r\n";
+
+    // fed a few bytes at a time, as a slow client would send them
+    HttpRequestParser parser;
+    HttpRequestParser::Request request;
+    size_t received = 0;
+    HttpRequestParser::Status status = HttpRequestParser::Status::Incomplete;
+    while (status == HttpRequestParser::Status::Incomplete) {
+        received = std::min(stream.size(), received + 7001);
+        status = parser.Parse(std::string_view(stream).substr(0, received),
+                              &request);
+    }
+    ASSERT_EQ(status, HttpRequestParser::Status::Complete);
+    EXPECT_EQ(request.method, "PUT");
+    EXPECT_EQ(request.target, "/profiles/clientId:aa:11:cc:dd:ee:ff");
+    ASSERT_EQ(request.header_count, 3);
+    EXPECT_EQ(request.headers[2].name, "X-Client-Id");
+    EXPECT_EQ(request.headers[2].value, "7");
+    EXPECT_EQ(request.body.size(), body.size());
+    EXPECT_EQ(request.body.data(), stream.data() + request.size - body.size());
+    EXPECT_TRUE(request.keep_alive);
+
+    // the pipelined request follows in the same buffer
+    std::string_view rest = std::string_view(stream).substr(request.size);
+    ASSERT_EQ(parser.Parse(rest, &request),
+              HttpRequestParser::Status::Complete);
+    EXPECT_EQ(request.target, "/second");
+    EXPECT_TRUE(request.body.empty());
+    EXPECT_FALSE(request.keep_alive);
+    EXPECT_EQ(request.size, rest.size());
+
+    // the client waits for a 100 Continue once, then sends the body
+    std::string expect =
+        "PUT / HTTP/1.1\r\nExpect: 100-Continue\r\nContent-Length: 2\r\n"
+        "\r\n";
+    parser.Reset();
+    EXPECT_EQ(parser.Parse(expect, &request),
+              HttpRequestParser::Status::Continue);
+    EXPECT_EQ(parser.Parse(expect + "x", &request),
+              HttpRequestParser::Status::Incomplete);
+    ASSERT_EQ(parser.Parse(expect + "xy", &request),
+              HttpRequestParser::Status::Complete);
+    EXPECT_TRUE(request.expect_continue);
+    EXPECT_EQ(request.body, "xy");
+    // a body already there needs no interim reply, HTTP/1.0 never gets one
+    parser.Reset();
+    EXPECT_EQ(parser.Parse(expect + "xy", &request),
+              HttpRequestParser::Status::Complete);
+    std::string expect_10 =
+        "PUT / HTTP/1.0\r\nExpect: 100-continue\r\nContent-Length: 2\r\n"
+        "\r\n";
+    parser.Reset();
+    EXPECT_EQ(parser.Parse(expect_10, &request),
+              HttpRequestParser::Status::Incomplete);
+
+    std::vector<std::string> invalid = {
+        "GET\r\n\r\n", "GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+        "PUT / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "PUT / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"};
+    for (const auto& text : invalid) {
+        parser.Reset();
+        EXPECT_EQ(parser.Parse(text, &request),
+                  HttpRequestParser::Status::Invalid)
+            << text;
+    }
+}